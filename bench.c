@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+#define MICRO_ARENA_STACK_MEM_SIZE (1 << 16)
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_OPS   200000
+#define BENCH_SLOTS 256
+
+typedef struct {
+  const char *name;
+  size_t (*size)(unsigned long r);
+} BenchWorkload;
+
+static unsigned long bench_rand_state;
+
+static unsigned long bench_rand(void)
+{
+  // xorshift64, the same seed replays the same workload
+  bench_rand_state ^= bench_rand_state << 13;
+  bench_rand_state ^= bench_rand_state >> 7;
+  bench_rand_state ^= bench_rand_state << 17;
+  return bench_rand_state;
+}
+
+static size_t bench_size_small(unsigned long r)
+{
+  return 8 + r % 57;
+}
+
+static size_t bench_size_mixed(unsigned long r)
+{
+  if (r % 10 == 0)
+    return 512 + r % 1537;
+  return 8 + r % 121;
+}
+
+static size_t bench_size_bimodal(unsigned long r)
+{
+  return (r % 4 == 0) ? 1024 : 16;
+}
+
+static const BenchWorkload bench_workloads[] = {
+  { "small",   bench_size_small   },
+  { "mixed",   bench_size_mixed   },
+  { "bimodal", bench_size_bimodal },
+};
+
+static const char *bench_policy_names[] = {
+  [MICRO_ARENA_FIRST_FIT]           = "first fit",
+  [MICRO_ARENA_NEXT_FIT]            = "next fit",
+  [MICRO_ARENA_BEST_FIT]            = "best fit",
+  [MICRO_ARENA_WORST_FIT]           = "worst fit",
+  [MICRO_ARENA_ADDRESS_ORDERED_FIT] = "address ordered",
+};
+
+static MicroArenaInline bench_storage;
+static MicroArena *const bench_arena = &bench_storage.arena;
+static void *bench_slots[BENCH_SLOTS];
+
+typedef struct {
+  const char *name;
+  MicroArenaPolicy policy;
+  MicroArenaRounding rounding;
+  size_t granule;
+  size_t min_split;
+} BenchConfig;
+
+typedef struct {
+  double seconds;
+  size_t mallocs;
+  size_t failures;
+  double peak_fragmentation;
+  size_t peak_free_chunks;
+  size_t total_free_chunks;  // Sum over the samples
+  size_t samples;
+} BenchResult;
+
+// Each op picks a random slot: a full slot is freed, an empty one
+// is filled with a new allocation. If sample_every is not 0, the
+// stats are sampled every sample_every ops, which makes the timing
+// meaningless.
+static BenchResult bench_replay(const BenchWorkload *workload,
+                                const BenchConfig *config,
+                                size_t ops, size_t sample_every)
+{
+  BenchResult result = {0};
+  MicroArenaStats stats;
+
+  micro_arena_init(&bench_storage);
+  micro_arena_set_policy(bench_arena, config->policy);
+  micro_arena_set_rounding(bench_arena, config->rounding, config->granule);
+  micro_arena_set_min_split(bench_arena, config->min_split);
+  for (size_t i = 0; i < BENCH_SLOTS; ++i)
+    bench_slots[i] = NULL;
+  bench_rand_state = 0x9E3779B97F4A7C15UL;
+
+  clock_t start = clock();
+  for (size_t op = 0; op < ops; ++op)
+  {
+    unsigned long r = bench_rand();
+    size_t slot = r % BENCH_SLOTS;
+    if (bench_slots[slot])
+    {
+      micro_arena_free(bench_arena, bench_slots[slot]);
+      bench_slots[slot] = NULL;
+    }
+    else
+    {
+      bench_slots[slot] =
+        micro_arena_malloc(bench_arena, workload->size(r >> 8));
+      result.mallocs++;
+      if (!bench_slots[slot])
+        result.failures++;
+    }
+
+    if (sample_every == 0 || op % sample_every != 0)
+      continue;
+    micro_arena_stats(bench_arena, &stats);
+    if (stats.fragmentation > result.peak_fragmentation)
+      result.peak_fragmentation = stats.fragmentation;
+    if (bench_arena->free_chunks.len > result.peak_free_chunks)
+      result.peak_free_chunks = bench_arena->free_chunks.len;
+    result.total_free_chunks += bench_arena->free_chunks.len;
+    result.samples++;
+  }
+  result.seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  return result;
+}
+
+static void bench_policies(void)
+{
+  printf("%-10s %-16s %10s %10s %10s %10s\n", "workload", "policy",
+         "Mops/s", "failures", "peak frag", "peak holes");
+
+  for (size_t w = 0;
+       w < sizeof(bench_workloads) / sizeof(bench_workloads[0]); ++w)
+  {
+    for (int p = MICRO_ARENA_FIRST_FIT;
+         p <= MICRO_ARENA_ADDRESS_ORDERED_FIT; ++p)
+    {
+      BenchConfig config = {
+        .name = bench_policy_names[p],
+        .policy = (MicroArenaPolicy)p,
+        .rounding = MICRO_ARENA_DEFAULT_ROUNDING,
+        .granule = MICRO_ARENA_DEFAULT_GRANULE,
+        .min_split = MICRO_ARENA_DEFAULT_MIN_SPLIT,
+      };
+      BenchResult timed =
+        bench_replay(&bench_workloads[w], &config, BENCH_OPS, 0);
+      BenchResult measured =
+        bench_replay(&bench_workloads[w], &config, BENCH_OPS, 1);
+      printf("%-10s %-16s %10.2f %10zu %10.3f %10zu\n",
+             bench_workloads[w].name, config.name,
+             BENCH_OPS / timed.seconds / 1e6, measured.failures,
+             measured.peak_fragmentation, measured.peak_free_chunks);
+    }
+  }
+}
+
+static size_t bench_size_odd(unsigned long r)
+{
+  return 1 + r % 700;
+}
+
+// Long running churn of odd sizes, which leave slivers behind when
+// sizes are exact
+static void bench_rounding(void)
+{
+  enum { OPS = 2000000, SAMPLE_EVERY = 16 };
+  static const BenchWorkload workload = { "odd", bench_size_odd };
+  static const BenchConfig configs[] = {
+    { "exact",          MICRO_ARENA_FIRST_FIT, MICRO_ARENA_ROUND_NONE,      1,  0 },
+    { "min split 16",   MICRO_ARENA_FIRST_FIT, MICRO_ARENA_ROUND_NONE,      1,  16 },
+    { "granule 16",     MICRO_ARENA_FIRST_FIT, MICRO_ARENA_ROUND_GRANULE,   16, 1 },
+    { "geometric",      MICRO_ARENA_FIRST_FIT, MICRO_ARENA_ROUND_GEOMETRIC, 16, 1 },
+    { "geometric+32",   MICRO_ARENA_FIRST_FIT, MICRO_ARENA_ROUND_GEOMETRIC, 16, 32 },
+  };
+
+  printf("\n%-14s %10s %10s %10s %10s\n", "rounding", "failures",
+         "fail rate", "avg chunks", "peak chunks");
+  for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c)
+  {
+    BenchResult result =
+      bench_replay(&workload, &configs[c], OPS, SAMPLE_EVERY);
+    printf("%-14s %10zu %9.3f%% %10.1f %10zu\n", configs[c].name,
+           result.failures, 100.0 * result.failures / result.mallocs,
+           (double)result.total_free_chunks / result.samples,
+           result.peak_free_chunks);
+  }
+}
+
+// Random churn of objects of one size, from a MicroArenaPool and
+// from micro_arena_malloc
+static void bench_pool(void)
+{
+  enum { OPS = 2000000 };
+  static const size_t sizes[] = { 32, 128 };
+
+  printf("\n%-6s %-20s %10s\n", "size", "allocator", "Mops/s");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+  {
+    for (int use_pool = 1; use_pool >= 0; --use_pool)
+    {
+      MicroArenaPool pool;
+      micro_arena_init(&bench_storage);
+      if (use_pool)
+        micro_arena_pool_init(&pool, bench_arena, sizes[s],
+                              BENCH_SLOTS / 2, true);
+      for (size_t i = 0; i < BENCH_SLOTS; ++i)
+        bench_slots[i] = NULL;
+      bench_rand_state = 0x9E3779B97F4A7C15UL;
+
+      clock_t start = clock();
+      for (size_t op = 0; op < OPS; ++op)
+      {
+        size_t slot = bench_rand() % BENCH_SLOTS;
+        if (bench_slots[slot])
+        {
+          if (use_pool)
+            micro_arena_pool_free(&pool, bench_slots[slot]);
+          else
+            micro_arena_free(bench_arena, bench_slots[slot]);
+          bench_slots[slot] = NULL;
+        }
+        else if (use_pool)
+          bench_slots[slot] = micro_arena_pool_alloc(&pool);
+        else
+          bench_slots[slot] = micro_arena_malloc(bench_arena, sizes[s]);
+      }
+      double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+      printf("%-6zu %-20s %10.2f\n", sizes[s],
+             use_pool ? "micro_arena_pool" : "micro_arena_malloc",
+             OPS / seconds / 1e6);
+      if (use_pool)
+        micro_arena_pool_destroy(&pool);
+    }
+  }
+}
+
+// Random churn of power of two sizes, from the first fit arena and
+// from a buddy allocator over a buffer of the same size
+static void bench_buddy(void)
+{
+  enum { OPS = 2000000 };
+  static char buddy_mem[MICRO_ARENA_STACK_MEM_SIZE];
+  MicroArenaBuddy buddy;
+
+  printf("\n%-20s %10s %10s\n", "engine", "Mops/s", "failures");
+  for (int use_buddy = 1; use_buddy >= 0; --use_buddy)
+  {
+    size_t failures = 0;
+    micro_arena_init(&bench_storage);
+    micro_arena_buddy_init(&buddy, buddy_mem, sizeof(buddy_mem));
+    for (size_t i = 0; i < BENCH_SLOTS; ++i)
+      bench_slots[i] = NULL;
+    bench_rand_state = 0x9E3779B97F4A7C15UL;
+
+    clock_t start = clock();
+    for (size_t op = 0; op < OPS; ++op)
+    {
+      unsigned long r = bench_rand();
+      size_t slot = r % BENCH_SLOTS;
+      size_t size = (size_t)16 << ((r >> 8) % 7);
+      if (bench_slots[slot])
+      {
+        if (use_buddy)
+          micro_arena_buddy_free(&buddy, bench_slots[slot]);
+        else
+          micro_arena_free(bench_arena, bench_slots[slot]);
+        bench_slots[slot] = NULL;
+        continue;
+      }
+
+      if (use_buddy)
+        bench_slots[slot] = micro_arena_buddy_malloc(&buddy, size);
+      else
+        bench_slots[slot] = micro_arena_malloc(bench_arena, size);
+      if (!bench_slots[slot])
+        failures++;
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%-20s %10.2f %10zu\n", use_buddy ? "buddy" : "first fit",
+           OPS / seconds / 1e6, failures);
+  }
+}
+
+// The fit search without SIMD, what micro_arena_chunk_list_find_fit
+// does with MICRO_ARENA_NO_SIMD
+static size_t bench_find_fit_scalar(const MicroArenaChunkList *chunk_list,
+                                    size_t size)
+{
+  for (size_t i = 0; i < chunk_list->len; ++i)
+    if (chunk_list->sizes[i] >= size)
+      return i;
+  return chunk_list->len;
+}
+
+// First fit search over a free list close to the chunk limit, where
+// only the last free chunk fits, with the scalar and the SIMD search
+static void bench_scan(void)
+{
+  enum { BLOCKS = 1000, RUN = 8, ROUNDS = 20000 };
+  static void *blocks[BLOCKS];
+
+  micro_arena_init(&bench_storage);
+  for (size_t i = 0; i < BLOCKS; ++i)
+    blocks[i] = micro_arena_malloc(bench_arena, 16);
+  for (size_t i = 0; i < BLOCKS - RUN - 2; i += 2)
+    micro_arena_free(bench_arena, blocks[i]);
+  for (size_t i = BLOCKS - RUN - 1; i < BLOCKS - 1; ++i)
+    micro_arena_free(bench_arena, blocks[i]);
+  // Leave no memory at the end of the arena
+  while (micro_arena_malloc(bench_arena, 16 * RUN + 1) != NULL);
+
+  #if defined(MICRO_ARENA_SIMD_AVX2)
+  const char *simd = "avx2";
+  #elif defined(MICRO_ARENA_SIMD_SSE42)
+  const char *simd = "sse4.2";
+  #else
+  const char *simd = "none, scalar";
+  #endif
+
+  MicroArenaChunkList *free_chunks = &bench_arena->free_chunks;
+  volatile size_t found = 0;
+  clock_t start = clock();
+  for (size_t i = 0; i < ROUNDS; ++i)
+    found += bench_find_fit_scalar(free_chunks, 16 * RUN + i % 2);
+  double scalar_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  for (size_t i = 0; i < ROUNDS; ++i)
+    found += micro_arena_chunk_list_find_fit(free_chunks,
+                                             16 * RUN + i % 2, 0);
+  double simd_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  for (size_t i = 0; i < ROUNDS; ++i)
+  {
+    void *p = micro_arena_malloc(bench_arena, 16 * RUN);
+    micro_arena_free(bench_arena, p);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("\nfirst fit over %zu free chunks, %zu bytes of chunk tables\n",
+         free_chunks->len,
+         4 * MICRO_ARENA_MAX_NUM_CHUNKS * sizeof(MicroArenaSize));
+  printf("  scalar search: %.1f ns\n", scalar_seconds / ROUNDS * 1e9);
+  printf("  simd search (%s): %.1f ns\n", simd,
+         simd_seconds / ROUNDS * 1e9);
+  printf("  malloc+free: %.1f ns\n", seconds / ROUNDS * 1e9);
+}
+
+// Short requests doing scratch allocations and touching a buffer
+// too big for the stack memory, so that the arena grows. Each
+// request gets a fresh arena that maps and drops its segment, or an
+// arena of a MicroArenaCache that keeps its segment, or gives it
+// back with a retain of 0
+static void bench_requests(void)
+{
+  enum { REQUESTS = 20000, ALLOCS = 64, SEGMENT = 1 << 18 };
+  static const char *const names[] = {
+    "init + destroy", "cache", "cache, retain 0",
+  };
+  static MicroArenaInline cache_arenas[4];
+  MicroArenaCache cache;
+  micro_arena_cache_init(&cache, cache_arenas, 4);
+  for (size_t i = 0; i < 4; ++i)
+    micro_arena_set_growth(&cache_arenas[i].arena, SEGMENT);
+
+  printf("\n%-20s %12s\n", "arena per request", "ns/request");
+  for (int mode = 0; mode < 3; ++mode)
+  {
+    if (mode == 2)
+      micro_arena_cache_set_retain(&cache, 0);
+    bench_rand_state = 0x9E3779B97F4A7C15UL;
+    clock_t start = clock();
+    for (size_t r = 0; r < REQUESTS; ++r)
+    {
+      MicroArena *ma = bench_arena;
+      if (mode > 0)
+        ma = micro_arena_cache_acquire(&cache);
+      else
+      {
+        micro_arena_init(&bench_storage);
+        micro_arena_set_growth(ma, SEGMENT);
+      }
+
+      for (size_t i = 0; i < ALLOCS; ++i)
+        bench_slots[i] = micro_arena_malloc(ma, bench_size_small(bench_rand()));
+      char *buf = micro_arena_malloc(ma, MICRO_ARENA_STACK_MEM_SIZE);
+      for (size_t i = 0; buf && i < MICRO_ARENA_STACK_MEM_SIZE; i += 4096)
+        buf[i] = (char)r;
+
+      if (mode > 0)
+        micro_arena_cache_release(&cache, ma);
+      else
+        micro_arena_destroy(ma);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%-20s %12.1f\n", names[mode], seconds / REQUESTS * 1e9);
+  }
+  micro_arena_cache_destroy(&cache);
+}
+
+// Random churn of one struct type with MICRO_ARENA_NEW, through the
+// size class pools and through the arena
+static void bench_new(void)
+{
+  enum { OPS = 2000000 };
+  typedef struct { char payload[48]; } BenchNode;
+
+  printf("\n%-20s %10s\n", "MICRO_ARENA_NEW", "Mops/s");
+  for (int use_classes = 1; use_classes >= 0; --use_classes)
+  {
+    MicroArenaSizeClasses classes;
+    micro_arena_init(&bench_storage);
+    if (use_classes)
+      micro_arena_size_classes_init(&classes, bench_arena,
+                                    BENCH_SLOTS / 2);
+    for (size_t i = 0; i < BENCH_SLOTS; ++i)
+      bench_slots[i] = NULL;
+    bench_rand_state = 0x9E3779B97F4A7C15UL;
+
+    clock_t start = clock();
+    for (size_t op = 0; op < OPS; ++op)
+    {
+      size_t slot = bench_rand() % BENCH_SLOTS;
+      if (bench_slots[slot])
+      {
+        BenchNode *node = (BenchNode*)bench_slots[slot];
+        MICRO_ARENA_DELETE(bench_arena, node);
+        bench_slots[slot] = NULL;
+      }
+      else
+        bench_slots[slot] = MICRO_ARENA_NEW(bench_arena, BenchNode);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%-20s %10.2f\n", use_classes ? "size classes" : "arena",
+           OPS / seconds / 1e6);
+    if (use_classes)
+      micro_arena_size_classes_destroy(&classes);
+  }
+}
+
+int main(void)
+{
+  bench_policies();
+  bench_rounding();
+  bench_pool();
+  bench_buddy();
+  bench_scan();
+  bench_requests();
+  bench_new();
+  return 0;
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+#include <utility>
+
+constexpr int BENCH_COROUTINES = 2000000;
+
+// Lazy coroutine returning an int
+struct task
+{
+  struct promise_type : micro_arena::coroutine_promise
+  {
+    int value = 0;
+
+    task get_return_object()
+    {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_value(int v) noexcept { value = v; }
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task &operator=(task &&) = delete;
+  ~task()
+  {
+    if (handle)
+      handle.destroy();
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// Kept out of line so the frames are really allocated
+[[gnu::noinline]] static task handler(int request)
+{
+  co_return request * 2;
+}
+
+// Nanoseconds per coroutine created, run and destroyed
+static double bench_coroutines()
+{
+  volatile long sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_COROUTINES; ++i)
+  {
+    task t = handler(i);
+    t.handle.resume();
+    sum = sum + t.handle.promise().value;
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count() / BENCH_COROUTINES * 1e9;
+}
+
+int main()
+{
+  std::printf("%-20s %10s\n", "coroutine frames", "ns/frame");
+  double heap = bench_coroutines();
+  std::printf("%-20s %10.1f\n", "operator new", heap);
+
+  micro_arena::arena a;
+  micro_arena::coroutine_scope scope(a);
+  double arena = bench_coroutines();
+  std::printf("%-20s %10.1f\n", "micro_arena", arena);
+
+  MicroArenaSizeClasses classes;
+  micro_arena_size_classes_init(&classes, a.get(), 64);
+  double pooled = bench_coroutines();
+  std::printf("%-20s %10.1f\n", "size classes", pooled);
+  micro_arena_size_classes_destroy(&classes);
+  return 0;
+}
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+#define MICRO_ARENA_STACK_MEM_SIZE (1 << 20)
+#define MICRO_ARENA_MAX_NUM_CHUNKS 8192
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum { BENCH_ROUNDS = 2000, BENCH_ELEMENTS = 1000 };
+
+static MicroArenaInline bench_storage;
+
+template <typename F>
+static double bench_seconds(F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// Vectors grown one element at a time, then dropped
+static void bench_vector(std::pmr::memory_resource *resource)
+{
+  for (int r = 0; r < BENCH_ROUNDS; ++r)
+  {
+    std::pmr::vector<int> v(resource);
+    for (int i = 0; i < BENCH_ELEMENTS; ++i)
+      v.push_back(i);
+  }
+}
+
+// Node based map filled, looked up, then dropped
+static void bench_map(std::pmr::memory_resource *resource)
+{
+  volatile long sum = 0;
+  for (int r = 0; r < BENCH_ROUNDS / 10; ++r)
+  {
+    std::pmr::unordered_map<int, long> m(resource);
+    for (int i = 0; i < BENCH_ELEMENTS; ++i)
+      m.emplace(i * 7, i);
+    for (int i = 0; i < BENCH_ELEMENTS; ++i)
+      sum += m[i * 7];
+  }
+}
+
+static void bench_memory_resource()
+{
+  micro_arena_init(&bench_storage);
+  micro_arena::memory_resource arena_resource(&bench_storage.arena);
+  std::pmr::memory_resource *resources[] = {
+    std::pmr::new_delete_resource(), &arena_resource,
+  };
+  const char *names[] = { "new_delete", "micro_arena" };
+
+  std::printf("%-14s %12s %12s\n", "resource", "vector ms", "map ms");
+  for (int i = 0; i < 2; ++i)
+  {
+    double vector = bench_seconds([&] { bench_vector(resources[i]); });
+    double map = bench_seconds([&] { bench_map(resources[i]); });
+    std::printf("%-14s %12.2f %12.2f\n", names[i], vector * 1e3, map * 1e3);
+  }
+}
+
+// Small vectors built and dropped per call, with the memory on the
+// stack or from the upstream resource
+static void bench_small(bool use_inline)
+{
+  volatile long sum = 0;
+  for (int r = 0; r < BENCH_ROUNDS * 100; ++r)
+  {
+    micro_arena::inline_arena<512> stack(std::pmr::new_delete_resource());
+    std::pmr::memory_resource *resource =
+      use_inline ? &stack : std::pmr::new_delete_resource();
+    std::pmr::vector<int> v(resource);
+    for (int i = 0; i < 32; ++i)
+      v.push_back(i);
+    sum += v[r % 32];
+  }
+}
+
+static void bench_inline_arena()
+{
+  std::printf("\n%-14s %12s\n", "small vectors", "ms");
+  double heap = bench_seconds([] { bench_small(false); });
+  double stack = bench_seconds([] { bench_small(true); });
+  std::printf("%-14s %12.2f\n", "new_delete", heap * 1e3);
+  std::printf("%-14s %12.2f\n", "inline_arena", stack * 1e3);
+}
+
+// Message with a non-trivial destructor
+struct bench_message
+{
+  int id;
+  double values[4];
+  std::string name;
+
+  explicit bench_message(int i) : id(i), values{}, name("message") {}
+};
+
+// Batches of messages built then dropped, with new and delete or in
+// an arena_owned reset after each batch
+static void bench_arena_owned()
+{
+  enum { BATCH = 10000, BATCHES = 100 };
+  static bench_message *messages[BATCH];
+
+  double heap = bench_seconds([] {
+    for (int b = 0; b < BATCHES; ++b)
+    {
+      for (int i = 0; i < BATCH; ++i)
+        messages[i] = new bench_message(i);
+      for (int i = 0; i < BATCH; ++i)
+        delete messages[i];
+    }
+  });
+
+  micro_arena::arena_owned owned(1 << 20);
+  double arena = bench_seconds([&] {
+    for (int b = 0; b < BATCHES; ++b)
+    {
+      for (int i = 0; i < BATCH; ++i)
+        messages[i] = owned.create<bench_message>(i);
+      owned.reset();
+    }
+  });
+
+  std::printf("\n%-14s %12s\n", "messages", "ms");
+  std::printf("%-14s %12.2f\n", "new/delete", heap * 1e3);
+  std::printf("%-14s %12.2f\n", "arena_owned", arena * 1e3);
+}
+
+int main()
+{
+  bench_memory_resource();
+  bench_inline_arena();
+  bench_arena_owned();
+  return 0;
+}
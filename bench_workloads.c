@@ -0,0 +1,620 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Standard allocator workloads on micro_arena_*, with the default and
+// the address ordered policy, and on the C library malloc, printed as
+// CSV (the default) or JSON:
+//
+//   ./benchmark_workloads [--csv|--json]
+//
+// Each workload runs twice per allocator: once for the throughput,
+// then timing every call for the latency percentiles and the peak
+// footprint. The footprint of the arena is the highest byte it
+// handed out; the one of malloc is the memory its arenas hold
+// according to mallinfo2, sampled every SUITE_SAMPLE_INTERVAL calls.
+// The arena is shared by all the threads, behind its mutex.
+
+#define _GNU_SOURCE
+#define MICRO_ARENA_MULTITHREADED
+#define MICRO_ARENA_STACK_MEM_SIZE 0
+#define MICRO_ARENA_MAX_NUM_CHUNKS 0
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Calls per workload, split between its threads
+#define SUITE_OPS             200000
+// Objects live at once per thread
+#define SUITE_SLOTS           1000
+#define SUITE_MAX_THREADS     4
+#define SUITE_LARSON_ROUNDS   10
+#define SUITE_SAMPLE_INTERVAL 1024
+#define SUITE_CAPACITY        (64 << 20)
+#define SUITE_MAX_CHUNKS      (1 << 15)
+
+typedef struct {
+  const char *name;
+  void *(*alloc)(size_t size);
+  void (*release)(void *ptr);
+  void *(*resize)(void *ptr, size_t size);
+  void (*reset)(void);
+  // Update the peak footprint after the calls-th call of a thread
+  void (*track)(void *ptr, size_t size, size_t calls);
+} SuiteAllocator;
+
+typedef struct {
+  const SuiteAllocator *allocator;
+  int id;
+  int num_threads;
+  size_t budget;            // Calls to make
+  size_t calls;
+  size_t failures;
+  unsigned long rand_state;
+  uint64_t *latencies;      // NULL when not measuring
+  size_t num_latencies;
+  size_t max_latencies;
+  void **slots;             // SUITE_SLOTS entries
+} SuiteThread;
+
+typedef struct {
+  const char *name;
+  int num_threads;
+  void (*run)(SuiteThread *t);
+} SuiteWorkload;
+
+static MicroArena suite_arena;
+static size_t suite_peak;
+static size_t suite_libc_baseline;  // Held by malloc before the pass
+static pthread_barrier_t suite_barrier;
+
+//
+// Allocators
+//
+
+static void *suite_arena_alloc(size_t size)
+{
+  return micro_arena_malloc(&suite_arena, size);
+}
+
+static void suite_arena_release(void *ptr)
+{
+  micro_arena_free(&suite_arena, ptr);
+  return;
+}
+
+static void *suite_arena_resize(void *ptr, size_t size)
+{
+  return micro_arena_realloc(&suite_arena, ptr, size);
+}
+
+static void suite_arena_reset(void)
+{
+  micro_arena_reset(&suite_arena);
+  micro_arena_set_policy(&suite_arena, MICRO_ARENA_DEFAULT_POLICY);
+  return;
+}
+
+static void suite_arena_address_reset(void)
+{
+  micro_arena_reset(&suite_arena);
+  micro_arena_set_policy(&suite_arena, MICRO_ARENA_ADDRESS_ORDERED_FIT);
+  return;
+}
+
+static void suite_peak_update(size_t bytes)
+{
+  size_t peak = __atomic_load_n(&suite_peak, __ATOMIC_RELAXED);
+  while (bytes > peak
+         && !__atomic_compare_exchange_n(&suite_peak, &peak, bytes, true,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED))
+    ;
+  return;
+}
+
+static void suite_arena_track(void *ptr, size_t size, size_t calls)
+{
+  (void)calls;
+  if (ptr)
+    suite_peak_update((size_t)((char*)ptr - suite_arena.base) + size);
+  return;
+}
+
+static size_t suite_libc_held(void)
+{
+  struct mallinfo2 info = mallinfo2();
+  return info.arena + info.hblkhd;
+}
+
+static void suite_libc_reset(void)
+{
+  malloc_trim(0);
+  suite_libc_baseline = suite_libc_held();
+  return;
+}
+
+static void suite_libc_track(void *ptr, size_t size, size_t calls)
+{
+  (void)ptr;
+  (void)size;
+  if (calls % SUITE_SAMPLE_INTERVAL != 0)
+    return;
+  size_t held = suite_libc_held();
+  if (held > suite_libc_baseline)
+    suite_peak_update(held - suite_libc_baseline);
+  return;
+}
+
+static const SuiteAllocator suite_allocators[] = {
+  { "micro_arena", suite_arena_alloc, suite_arena_release,
+    suite_arena_resize, suite_arena_reset, suite_arena_track },
+  { "micro_arena_address", suite_arena_alloc, suite_arena_release,
+    suite_arena_resize, suite_arena_address_reset, suite_arena_track },
+  { "libc", malloc, free, realloc, suite_libc_reset, suite_libc_track },
+};
+
+//
+// Timed calls
+//
+
+static uint64_t suite_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static unsigned long suite_rand(SuiteThread *t)
+{
+  // xorshift64, the same seed replays the same workload
+  t->rand_state ^= t->rand_state << 13;
+  t->rand_state ^= t->rand_state >> 7;
+  t->rand_state ^= t->rand_state << 17;
+  return t->rand_state;
+}
+
+static void suite_record(SuiteThread *t, uint64_t start, void *ptr,
+                         size_t size)
+{
+  uint64_t elapsed = suite_now() - start;
+  if (t->num_latencies < t->max_latencies)
+    t->latencies[t->num_latencies++] = elapsed;
+  t->allocator->track(ptr, size, t->calls);
+  return;
+}
+
+static void *suite_alloc(SuiteThread *t, size_t size)
+{
+  uint64_t start = t->latencies ? suite_now() : 0;
+  void *ptr = t->allocator->alloc(size);
+  t->calls++;
+  if (t->latencies)
+    suite_record(t, start, ptr, size);
+  if (!ptr)
+    t->failures++;
+  return ptr;
+}
+
+static void suite_release(SuiteThread *t, void *ptr)
+{
+  if (!ptr)
+    return;
+  uint64_t start = t->latencies ? suite_now() : 0;
+  t->allocator->release(ptr);
+  t->calls++;
+  if (t->latencies)
+    suite_record(t, start, NULL, 0);
+  return;
+}
+
+static void *suite_resize(SuiteThread *t, void *ptr, size_t size)
+{
+  uint64_t start = t->latencies ? suite_now() : 0;
+  void *mem = t->allocator->resize(ptr, size);
+  t->calls++;
+  if (t->latencies)
+    suite_record(t, start, mem, size);
+  if (!mem)
+    t->failures++;
+  return mem;
+}
+
+static void suite_release_slots(SuiteThread *t, void **slots)
+{
+  for (size_t i = 0; i < SUITE_SLOTS; ++i)
+  {
+    suite_release(t, slots[i]);
+    slots[i] = NULL;
+  }
+  return;
+}
+
+//
+// Workloads
+//
+
+// Random allocations and frees of one size
+static void suite_constant_churn(SuiteThread *t)
+{
+  while (t->calls < t->budget)
+  {
+    size_t slot = suite_rand(t) % SUITE_SLOTS;
+    if (t->slots[slot])
+    {
+      suite_release(t, t->slots[slot]);
+      t->slots[slot] = NULL;
+    }
+    else
+      t->slots[slot] = suite_alloc(t, 64);
+  }
+  suite_release_slots(t, t->slots);
+  return;
+}
+
+// Random allocations and frees of 8 to 1024 bytes
+static void suite_random_churn(SuiteThread *t)
+{
+  while (t->calls < t->budget)
+  {
+    unsigned long r = suite_rand(t);
+    size_t slot = r % SUITE_SLOTS;
+    if (t->slots[slot])
+    {
+      suite_release(t, t->slots[slot]);
+      t->slots[slot] = NULL;
+    }
+    else
+      t->slots[slot] = suite_alloc(t, 8 + (r >> 16) % 1017);
+  }
+  suite_release_slots(t, t->slots);
+  return;
+}
+
+// Stacks of allocations freed in reverse order
+static void suite_lifo(SuiteThread *t)
+{
+  while (t->calls < t->budget)
+  {
+    for (size_t i = 0; i < SUITE_SLOTS; ++i)
+      t->slots[i] = suite_alloc(t, 16 + suite_rand(t) % 241);
+    for (size_t i = SUITE_SLOTS; i > 0; --i)
+    {
+      suite_release(t, t->slots[i - 1]);
+      t->slots[i - 1] = NULL;
+    }
+  }
+  return;
+}
+
+// A queue of allocations freed oldest first
+static void suite_fifo(SuiteThread *t)
+{
+  size_t head = 0;
+  while (t->calls < t->budget)
+  {
+    suite_release(t, t->slots[head]);
+    t->slots[head] = suite_alloc(t, 16 + suite_rand(t) % 241);
+    head = (head + 1) % SUITE_SLOTS;
+  }
+  suite_release_slots(t, t->slots);
+  return;
+}
+
+// A buffer grown 64 bytes at a time up to 16 KiB
+static void suite_realloc_growth(SuiteThread *t)
+{
+  void *buf = NULL;
+  size_t size = 0;
+  while (t->calls < t->budget)
+  {
+    size += 64;
+    void *mem = suite_resize(t, buf, size);
+    if (mem)
+      buf = mem;
+    if (!mem || size >= 16384)
+    {
+      suite_release(t, buf);
+      buf = NULL;
+      size = 0;
+    }
+  }
+  suite_release(t, buf);
+  return;
+}
+
+// Thread 0 allocates, thread 1 frees, through a bounded queue
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  void *items[SUITE_SLOTS];
+  size_t head, len;
+} suite_queue = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL }, 0, 0,
+};
+
+static void suite_producer_consumer(SuiteThread *t)
+{
+  // Each allocation is one call of each thread
+  for (size_t n = 0; n < t->budget; ++n)
+  {
+    void *ptr = NULL;
+    if (t->id == 0)
+      ptr = suite_alloc(t, 16 + suite_rand(t) % 241);
+
+    pthread_mutex_lock(&suite_queue.mutex);
+    if (t->id == 0)
+    {
+      while (suite_queue.len == SUITE_SLOTS)
+        pthread_cond_wait(&suite_queue.changed, &suite_queue.mutex);
+      suite_queue.items[(suite_queue.head + suite_queue.len++)
+                        % SUITE_SLOTS] = ptr;
+    }
+    else
+    {
+      while (suite_queue.len == 0)
+        pthread_cond_wait(&suite_queue.changed, &suite_queue.mutex);
+      ptr = suite_queue.items[suite_queue.head];
+      suite_queue.head = (suite_queue.head + 1) % SUITE_SLOTS;
+      suite_queue.len--;
+    }
+    pthread_cond_broadcast(&suite_queue.changed);
+    pthread_mutex_unlock(&suite_queue.mutex);
+
+    if (t->id == 1)
+      suite_release(t, ptr);
+  }
+  return;
+}
+
+// Larson: random churn where each round a thread takes over the
+// objects of another, so most frees come from other threads
+static void *suite_larson_slots[SUITE_MAX_THREADS][SUITE_SLOTS];
+
+static void suite_larson(SuiteThread *t)
+{
+  size_t per_round = t->budget / SUITE_LARSON_ROUNDS;
+  for (int round = 0; round < SUITE_LARSON_ROUNDS; ++round)
+  {
+    void **slots = suite_larson_slots[(t->id + round) % t->num_threads];
+    for (size_t n = 0; n < per_round; ++n)
+    {
+      unsigned long r = suite_rand(t);
+      size_t slot = r % SUITE_SLOTS;
+      if (slots[slot])
+      {
+        suite_release(t, slots[slot]);
+        slots[slot] = NULL;
+      }
+      else
+        slots[slot] = suite_alloc(t, 8 + (r >> 16) % 513);
+    }
+    pthread_barrier_wait(&suite_barrier);
+  }
+  suite_release_slots(t, suite_larson_slots[t->id]);
+  return;
+}
+
+// Threadtest: each thread allocates a batch, then frees it
+static void suite_threadtest(SuiteThread *t)
+{
+  while (t->calls < t->budget)
+  {
+    for (size_t i = 0; i < SUITE_SLOTS; ++i)
+      t->slots[i] = suite_alloc(t, 64);
+    suite_release_slots(t, t->slots);
+  }
+  return;
+}
+
+static const SuiteWorkload suite_workloads[] = {
+  { "constant_churn", 1, suite_constant_churn },
+  { "random_churn", 1, suite_random_churn },
+  { "lifo", 1, suite_lifo },
+  { "fifo", 1, suite_fifo },
+  { "realloc_growth", 1, suite_realloc_growth },
+  { "producer_consumer", 2, suite_producer_consumer },
+  { "larson", SUITE_MAX_THREADS, suite_larson },
+  { "threadtest", SUITE_MAX_THREADS, suite_threadtest },
+};
+
+//
+// Harness
+//
+
+typedef struct {
+  size_t calls;
+  size_t failures;
+  double seconds;
+  uint64_t p50, p99, p999;
+  size_t peak_bytes;
+} SuiteResult;
+
+static const SuiteWorkload *suite_current;
+
+static void *suite_thread_run(void *arg)
+{
+  SuiteThread *t = (SuiteThread*)arg;
+  suite_current->run(t);
+  return NULL;
+}
+
+static int suite_compare(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Run workload on allocator once, timing every call if measuring
+static void suite_pass(const SuiteWorkload *workload,
+                       const SuiteAllocator *allocator, bool measuring,
+                       SuiteResult *result)
+{
+  SuiteThread threads[SUITE_MAX_THREADS];
+  pthread_t handles[SUITE_MAX_THREADS];
+  int n = workload->num_threads;
+  size_t budget = SUITE_OPS / (size_t)n;
+  // Workloads finish their last batch past the budget
+  size_t max_latencies = budget + 2 * SUITE_SLOTS;
+
+  suite_current = workload;
+  memset(suite_larson_slots, 0, sizeof(suite_larson_slots));
+  pthread_barrier_init(&suite_barrier, NULL, (unsigned)n);
+
+  for (int i = 0; i < n; ++i)
+  {
+    SuiteThread *t = &threads[i];
+    memset(t, 0, sizeof(*t));
+    t->allocator = allocator;
+    t->id = i;
+    t->num_threads = n;
+    t->budget = budget;
+    t->rand_state = 0x9E3779B97F4A7C15UL + (unsigned long)i;
+    t->slots = (void**)calloc(SUITE_SLOTS, sizeof(void*));
+    if (measuring)
+    {
+      t->latencies = (uint64_t*)malloc(max_latencies * sizeof(uint64_t));
+      t->max_latencies = max_latencies;
+    }
+  }
+
+  // After the buffers of the pass, which are not part of the footprint
+  allocator->reset();
+  suite_peak = 0;
+
+  uint64_t start = suite_now();
+  for (int i = 0; i < n; ++i)
+    pthread_create(&handles[i], NULL, suite_thread_run, &threads[i]);
+  for (int i = 0; i < n; ++i)
+    pthread_join(handles[i], NULL);
+  double seconds = (double)(suite_now() - start) / 1e9;
+  pthread_barrier_destroy(&suite_barrier);
+
+  size_t total_latencies = 0;
+  for (int i = 0; i < n; ++i)
+    total_latencies += threads[i].num_latencies;
+  uint64_t *latencies = NULL;
+  if (measuring)
+    latencies = (uint64_t*)malloc((total_latencies + 1) * sizeof(uint64_t));
+
+  size_t len = 0;
+  if (!measuring)
+  {
+    result->calls = 0;
+    result->failures = 0;
+    result->seconds = seconds;
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    SuiteThread *t = &threads[i];
+    if (!measuring)
+    {
+      result->calls += t->calls;
+      result->failures += t->failures;
+    }
+    else
+    {
+      memcpy(latencies + len, t->latencies,
+             t->num_latencies * sizeof(uint64_t));
+      len += t->num_latencies;
+    }
+    free(t->latencies);
+    free(t->slots);
+  }
+
+  if (measuring && len > 0)
+  {
+    qsort(latencies, len, sizeof(uint64_t), suite_compare);
+    result->p50 = latencies[(len - 1) * 50 / 100];
+    result->p99 = latencies[(len - 1) * 99 / 100];
+    result->p999 = latencies[(len - 1) * 999 / 1000];
+    allocator->track(NULL, 0, 0);
+    result->peak_bytes = suite_peak;
+  }
+  free(latencies);
+  return;
+}
+
+int main(int argc, char **argv)
+{
+  bool json = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--json") == 0)
+      json = true;
+    else if (strcmp(argv[i], "--csv") == 0)
+      json = false;
+    else
+    {
+      fprintf(stderr, "usage: %s [--csv|--json]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  char *mem = (char*)malloc(SUITE_CAPACITY);
+  MicroArenaSize *chunks = (MicroArenaSize*)
+    malloc(4 * SUITE_MAX_CHUNKS * sizeof(MicroArenaSize));
+  if (!mem || !chunks
+      || !micro_arena_init_chunks(&suite_arena, mem, SUITE_CAPACITY,
+                                  chunks, SUITE_MAX_CHUNKS))
+    return 1;
+
+  if (json)
+    printf("[\n");
+  else
+    printf("workload,allocator,threads,calls,failures,ops_per_sec,"
+           "p50_ns,p99_ns,p999_ns,peak_bytes\n");
+
+  size_t num_workloads = sizeof(suite_workloads) / sizeof(suite_workloads[0]);
+  size_t num_allocators =
+    sizeof(suite_allocators) / sizeof(suite_allocators[0]);
+  for (size_t w = 0; w < num_workloads; ++w)
+  {
+    for (size_t a = 0; a < num_allocators; ++a)
+    {
+      const SuiteWorkload *workload = &suite_workloads[w];
+      const SuiteAllocator *allocator = &suite_allocators[a];
+      SuiteResult result;
+      memset(&result, 0, sizeof(result));
+      suite_pass(workload, allocator, false, &result);
+      suite_pass(workload, allocator, true, &result);
+      double ops_per_sec = result.calls / result.seconds;
+
+      bool last = w + 1 == num_workloads && a + 1 == num_allocators;
+      if (json)
+        printf("  {\"workload\": \"%s\", \"allocator\": \"%s\", "
+               "\"threads\": %d, \"calls\": %zu, \"failures\": %zu, "
+               "\"ops_per_sec\": %.0f, \"p50_ns\": %llu, "
+               "\"p99_ns\": %llu, \"p999_ns\": %llu, "
+               "\"peak_bytes\": %zu}%s\n",
+               workload->name, allocator->name, workload->num_threads,
+               result.calls, result.failures, ops_per_sec,
+               (unsigned long long)result.p50,
+               (unsigned long long)result.p99,
+               (unsigned long long)result.p999, result.peak_bytes,
+               last ? "" : ",");
+      else
+        printf("%s,%s,%d,%zu,%zu,%.0f,%llu,%llu,%llu,%zu\n",
+               workload->name, allocator->name, workload->num_threads,
+               result.calls, result.failures, ops_per_sec,
+               (unsigned long long)result.p50,
+               (unsigned long long)result.p99,
+               (unsigned long long)result.p999, result.peak_bytes);
+      fflush(stdout);
+    }
+  }
+  if (json)
+    printf("]\n");
+
+  micro_arena_destroy(&suite_arena);
+  free(mem);
+  free(chunks);
+  return 0;
+}
@@ -4,8 +4,9 @@
 // micro-arena.h
 // =============
 //
-// Header only memory allocator in C99 (first fit). It implements
-// the common memory functions from stdlib.h:
+// Header only memory allocator in C99 (first fit by default, see
+// MicroArenaPolicy). It implements the common memory functions from
+// stdlib.h:
 //
 //       void *micro_arena_malloc(MicroArena *ma, size_t size);
 //       void micro_arena_free(MicroArena *ma, void * ptr);
@@ -23,14 +24,15 @@
 // -------
 //
 //
-//     MicroArena ma;
-//     micro_arena_init(&ma);
+//     MicroArenaInline inl;
+//     micro_arena_init(&inl);
+//     MicroArena *ma = &inl.arena;
 //
 //     int array_len = 10;
-//     int* mem = micro_arena_malloc(&ma, sizeof(int) * array_len);
+//     int* mem = micro_arena_malloc(ma, sizeof(int) * array_len);
 //     assert(mem != NULL);  
 //
-//     micro_arena_free(&ma, mem);
+//     micro_arena_free(ma, mem);
 //
 //
 // Usage
@@ -97,85 +99,855 @@ extern "C" {
   #define MICRO_ARENA_DEF extern
 #endif
 
-// Config: Size of arena buffer allocated on the stack.
-#define MICRO_ARENA_STACK_MEM_SIZE 4096
+// Config: Size of the buffer of a MicroArenaInline, allocated on
+//         the stack. With 0 the MicroArenaInline has no buffer and
+//         micro_arena_init leaves it empty, see
+//         micro_arena_init_chunks.
+#ifndef MICRO_ARENA_STACK_MEM_SIZE
+  #define MICRO_ARENA_STACK_MEM_SIZE 4096
+#endif
 
 // Config: Include an example program, see the end of the header
 // #define MICRO_ARENA_EXAMPLE_MAIN
 
 // Config: Maximum number of pointers. A limit is required since
 //         we need to keep track of what pointers were allocated and
-//         what parts of memory are free.
+//         what parts of memory are free. This sizes the chunk tables
+//         inside each MicroArenaInline; with 0 they are left out and
+//         every arena is set up with micro_arena_init_chunks.
 #ifndef MICRO_ARENA_MAX_NUM_CHUNKS
   #define MICRO_ARENA_MAX_NUM_CHUNKS 1024
 #endif
 
+// Config: Placement policy of new arenas, see MicroArenaPolicy.
+//         It can be changed per arena with micro_arena_set_policy.
+#ifndef MICRO_ARENA_DEFAULT_POLICY
+  #define MICRO_ARENA_DEFAULT_POLICY MICRO_ARENA_FIRST_FIT
+#endif
+
+// Config: Free chunks are split only if the remainder is at least
+//         this many bytes, smaller remainders are given to the
+//         allocation. Slivers too small to be reused would still
+//         take a slot in the free chunk list. The default only
+//         drops empty chunks. It can be changed per arena with
+//         micro_arena_set_min_split.
+#ifndef MICRO_ARENA_DEFAULT_MIN_SPLIT
+  #define MICRO_ARENA_DEFAULT_MIN_SPLIT 1
+#endif
+
+// Config: How new arenas round allocation sizes, see
+//         MicroArenaRounding and micro_arena_set_rounding.
+#ifndef MICRO_ARENA_DEFAULT_ROUNDING
+  #define MICRO_ARENA_DEFAULT_ROUNDING MICRO_ARENA_ROUND_NONE
+#endif
+#ifndef MICRO_ARENA_DEFAULT_GRANULE
+  #define MICRO_ARENA_DEFAULT_GRANULE 16
+#endif
+
+// Config: Use the buddy allocator (see MicroArenaBuddy) in place of
+//         the free chunk lists in micro_arena_malloc, micro_arena_free
+//         and micro_arena_realloc. Sizes are rounded up to powers of
+//         two and both malloc and free are O(MICRO_ARENA_BUDDY_ORDERS).
+//         The placement policy, rounding and stats only apply to
+//         the free chunk lists.
+// #define MICRO_ARENA_BUDDY
+
+// Config: Smallest block of the buddy allocator, a power of two of
+//         at least 2 * sizeof(void*) bytes
+#ifndef MICRO_ARENA_BUDDY_MIN_BLOCK
+  #define MICRO_ARENA_BUDDY_MIN_BLOCK 16
+#endif
+
+// Config: Number of block sizes of the buddy allocator, the biggest
+//         block is MICRO_ARENA_BUDDY_MIN_BLOCK << (ORDERS - 1) bytes
+#ifndef MICRO_ARENA_BUDDY_ORDERS
+  #define MICRO_ARENA_BUDDY_ORDERS 24
+#endif
+
+// Config: Alignment of the slots of a MicroArenaPool. Slot sizes
+//         are rounded up to a multiple of it.
+#ifndef MICRO_ARENA_POOL_ALIGNMENT
+  #define MICRO_ARENA_POOL_ALIGNMENT 16
+#endif
+
+// Config: Number of size classes of MicroArenaSizeClasses, at most
+//         8. Class i holds objects of up to
+//         MICRO_ARENA_POOL_ALIGNMENT << i bytes.
+#ifndef MICRO_ARENA_SIZE_CLASSES
+  #define MICRO_ARENA_SIZE_CLASSES 5
+#endif
+
+// Config: Alignment of the allocations of a MicroArenaFrame
+#ifndef MICRO_ARENA_FRAME_ALIGNMENT
+  #define MICRO_ARENA_FRAME_ALIGNMENT 16
+#endif
+
+// Config: Maximum number of arenas in a MicroArenaCache
+#ifndef MICRO_ARENA_CACHE_MAX_ARENAS
+  #define MICRO_ARENA_CACHE_MAX_ARENAS 64
+#endif
+
+// Config: Allocator of the segments of growable arenas, see
+//         micro_arena_set_growth. Define both or neither, they
+//         default to malloc and free from stdlib.h.
+#ifndef MICRO_ARENA_BACKING_ALLOC
+  #define MICRO_ARENA_BACKING_ALLOC(size) malloc(size)
+  #define MICRO_ARENA_BACKING_FREE(ptr, size) free(ptr)
+  #define MICRO_ARENA_BACKING_STDLIB
+#endif
+
+// Config: Number of buckets in the free chunk size histogram of
+//         MicroArenaStats. Bucket i counts the free chunks with a
+//         size in [2^i, 2^(i+1)), the last one also counts bigger
+//         chunks.
+#ifndef MICRO_ARENA_STATS_BUCKETS
+  #define MICRO_ARENA_STATS_BUCKETS 32
+#endif
+
+// Config: Compact metadata. Chunks are stored as 32 bit offsets
+//         from the arena memory and 32 bit sizes instead of a
+//         pointer and a size_t, halving the chunk tables. With
+//         MICRO_ARENA_COMPACT_16 they take 16 bits each, for arenas
+//         smaller than 64 KiB.
+// #define MICRO_ARENA_COMPACT
+// #define MICRO_ARENA_COMPACT_16
+
+// Config: Disable the SIMD search of free chunks. The search uses
+//         AVX2 or SSE4.2 when the compiler targets them (for example
+//         with -mavx2 or -march=native) and a scalar loop otherwise.
+// #define MICRO_ARENA_NO_SIMD
+
 // Config: Include debug functions
 // #define MICRO_ARENA_DEBUG
 
 // Config: Enable thread safety
 // #define MICRO_ARENA_MULTITHREADED
 
+// Config: Record the calls to micro_arena_malloc, micro_arena_free,
+//         micro_arena_realloc and micro_arena_aligned_alloc of every
+//         arena, see micro_arena_trace_start. Needs POSIX
+//         clock_gettime, open and write.
+// #define MICRO_ARENA_TRACE
+
+// Config: Trace records buffered before they are written
+#ifndef MICRO_ARENA_TRACE_CAPACITY
+  #define MICRO_ARENA_TRACE_CAPACITY 4096
+#endif
+
 //
 // Types
 //
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef MICRO_ARENA_MULTITHREADED
   #include <pthread.h>
 #endif
   
-typedef struct {
-  char* start;
-  size_t size;
-} MicroArenaChunk;
+// Offsets and sizes of chunks, see MICRO_ARENA_COMPACT
+#if defined(MICRO_ARENA_COMPACT_16)
+  typedef uint16_t MicroArenaSize;
+  #define MICRO_ARENA_SIZE_MAX UINT16_MAX
+#elif defined(MICRO_ARENA_COMPACT)
+  typedef uint32_t MicroArenaSize;
+  #define MICRO_ARENA_SIZE_MAX UINT32_MAX
+#else
+  typedef size_t MicroArenaSize;
+  #define MICRO_ARENA_SIZE_MAX SIZE_MAX
+#endif
+
+// The arena memory must be addressable by a MicroArenaSize
+#if MICRO_ARENA_STACK_MEM_SIZE > 0
+typedef char micro_arena_check_mem_size
+  [(MICRO_ARENA_STACK_MEM_SIZE <= MICRO_ARENA_SIZE_MAX) ? 1 : -1];
+#endif
 
+// Chunks are stored as a struct of arrays: the fit search only
+// reads the sizes, which are contiguous and can be compared
+// several at a time. Offsets are relative to the arena memory.
 typedef struct {
-  MicroArenaChunk chunks[MICRO_ARENA_MAX_NUM_CHUNKS];
+  MicroArenaSize *offsets;
+  MicroArenaSize *sizes;
   size_t len;
+  size_t cap;
 } MicroArenaChunkList;
 
+// Which free chunk micro_arena_malloc carves an allocation from
+typedef enum {
+  // The first free chunk that is big enough
+  MICRO_ARENA_FIRST_FIT = 0,
+  // Like first fit, but the search starts from where the previous
+  // one ended
+  MICRO_ARENA_NEXT_FIT,
+  // The smallest free chunk that is big enough
+  MICRO_ARENA_BEST_FIT,
+  // The biggest free chunk
+  MICRO_ARENA_WORST_FIT,
+  // The big enough free chunk with the lowest address
+  MICRO_ARENA_ADDRESS_ORDERED_FIT,
+} MicroArenaPolicy;
+
+// How micro_arena_malloc rounds up the requested sizes. Fewer
+// distinct sizes make freed chunks easier to reuse.
+typedef enum {
+  // Exact sizes
+  MICRO_ARENA_ROUND_NONE = 0,
+  // Multiples of the granule
+  MICRO_ARENA_ROUND_GRANULE,
+  // Four size classes per power of two (16, 20, 24, 28, 32, 40,
+  // ...), which are also multiples of the granule
+  MICRO_ARENA_ROUND_GEOMETRIC,
+} MicroArenaRounding;
+
+// Binary buddy allocator over a memory region. Blocks of order k
+// are MICRO_ARENA_BUDDY_MIN_BLOCK << k bytes, each order has a free
+// list linked through the free blocks, and a block is merged with
+// its buddy (the block at address ^ size) as soon as both are free.
+// Every block is aligned to its size in memory. The region starts
+// with one tag byte per minimum block, see micro_arena_buddy_init.
 typedef struct {
-  char mem[MICRO_ARENA_STACK_MEM_SIZE];
+  unsigned char *tags;  // Order + 1 of each block start, 0x80 if free
+  char *base;           // First block, aligned to the minimum block
+  size_t size;          // Bytes managed from base
+  void *free_lists[MICRO_ARENA_BUDDY_ORDERS];
+} MicroArenaBuddy;
+
+// Callback run when the arena it was registered to is reset or
+// destroyed, see micro_arena_register_cleanup
+typedef void (*MicroArenaCleanupFn)(void *ctx);
+
+typedef struct MicroArenaCleanup {
+  MicroArenaCleanupFn fn;
+  void *ctx;
+  struct MicroArenaCleanup *next;  // Registered before this one
+} MicroArenaCleanup;
+
+typedef enum {
+  MICRO_ARENA_TRACE_MALLOC = 0,
+  MICRO_ARENA_TRACE_FREE,
+  MICRO_ARENA_TRACE_REALLOC,
+  MICRO_ARENA_TRACE_ALIGNED_ALLOC,
+} MicroArenaTraceOp;
+
+// A trace file starts with MICRO_ARENA_TRACE_MAGIC followed by the
+// records, in the byte order of the machine that wrote it. Pointers
+// are ids, valid from the call that returned them to the one that
+// freed them.
+#define MICRO_ARENA_TRACE_MAGIC "MATRACE1"
+typedef struct {
+  uint64_t time;       // Nanoseconds since micro_arena_trace_start
+  uint64_t ptr;        // Argument of free and realloc
+  uint64_t result;     // Returned by malloc, realloc and aligned_alloc
+  uint64_t size;
+  uint32_t alignment;  // Of aligned_alloc
+  uint16_t thread;     // 1 for the first thread recorded, and so on
+  uint16_t op;         // MicroArenaTraceOp
+} MicroArenaTraceRecord;
+
+// The arena points into itself, it must not be copied or moved
+// once initialized. It holds no memory of its own: see
+// MicroArenaInline for an arena with its memory inline, and
+// micro_arena_init_chunks for one over memory provided by the caller.
+typedef struct MicroArena {
+  char *base;       // Memory managed by the arena
+  size_t capacity;  // Bytes from base
+  struct MicroArena *next;  // Newest segment of a growable arena
+  size_t segment_size;      // 0 if the arena does not grow
+  MicroArenaCleanup *cleanups;  // Newest first
+  struct MicroArenaSizeClasses *size_classes;
+  #ifdef MICRO_ARENA_BUDDY
+  MicroArenaBuddy buddy;
+  #endif
   MicroArenaChunkList free_chunks;
   MicroArenaChunkList used_chunks;
+  MicroArenaPolicy policy;
+  size_t next_fit;  // Roving index of MICRO_ARENA_NEXT_FIT
+  size_t min_split;
+  MicroArenaRounding rounding;
+  size_t granule;
   #ifdef MICRO_ARENA_MULTITHREADED
   pthread_mutex_t arena_mutex;
   #endif
 } MicroArena;
 
+// A MicroArena followed by MICRO_ARENA_STACK_MEM_SIZE bytes of memory
+// and the chunk tables of MICRO_ARENA_MAX_NUM_CHUNKS chunks, see
+// micro_arena_init. Use it through &inl.arena. MICRO_ARENA_DEFINE,
+// basic_arena and the segments of growable arenas keep a MicroArena
+// next to storage of their own shape instead.
+typedef struct {
+  MicroArena arena;
+  #if MICRO_ARENA_STACK_MEM_SIZE > 0
+  char mem[MICRO_ARENA_STACK_MEM_SIZE];
+  #endif
+  #if MICRO_ARENA_MAX_NUM_CHUNKS > 0
+  MicroArenaSize chunk_mem[4 * MICRO_ARENA_MAX_NUM_CHUNKS];
+  #endif
+} MicroArenaInline;
+
+// Fragmentation indicators of an arena, see micro_arena_stats
+typedef struct {
+  size_t total_free;     // Sum of the sizes of all free chunks
+  size_t total_used;     // Sum of the sizes of all used chunks
+  size_t largest_free;   // Biggest allocation that can succeed
+  size_t free_chunks;    // Free chunks with a size > 0 (holes)
+  size_t used_chunks;
+  // 1 - largest_free / total_free. 0 means that all the free
+  // memory is contiguous, values close to 1 mean that the free
+  // memory is scattered in many small holes.
+  double fragmentation;
+  double average_hole;   // total_free / free_chunks
+  size_t histogram[MICRO_ARENA_STATS_BUCKETS];
+} MicroArenaStats;
+
+// Pool of fixed size slots carved from a MicroArena in slabs. Free
+// slots are linked through their first bytes and the arena only
+// sees one used chunk per slab, see micro_arena_pool_init.
+typedef struct {
+  MicroArena *arena;
+  size_t slot_size;
+  size_t slots_per_slab;
+  bool grow;
+  void *free_list;  // Freed slots
+  void *slabs;      // Header of the newest slab
+  char *bump;       // Never used slots of the newest slab
+  char *bump_end;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_t pool_mutex;
+  #endif
+} MicroArenaPool;
+
+// Pools for the small size classes of an arena, used by
+// micro_arena_class_malloc, MICRO_ARENA_NEW and micro_arena::make
+// once attached with micro_arena_size_classes_init.
+typedef struct MicroArenaSizeClasses {
+  MicroArenaPool pools[MICRO_ARENA_SIZE_CLASSES];
+} MicroArenaSizeClasses;
+
+typedef char micro_arena_check_size_classes
+  [(MICRO_ARENA_SIZE_CLASSES > 0 && MICRO_ARENA_SIZE_CLASSES <= 8) ? 1 : -1];
+
+#define MICRO_ARENA_SIZE_CLASS_FITS(size, i)                            \
+  ((i) < MICRO_ARENA_SIZE_CLASSES                                       \
+   && (size) <= ((size_t)MICRO_ARENA_POOL_ALIGNMENT << (i)))
+
+// Size class of objects of size bytes, MICRO_ARENA_SIZE_CLASSES if
+// they are too big for one. A constant expression if size is.
+#define MICRO_ARENA_SIZE_CLASS(size)                                    \
+  (MICRO_ARENA_SIZE_CLASS_FITS(size, 0) ? 0                             \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 1) ? 1                           \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 2) ? 2                           \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 3) ? 3                           \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 4) ? 4                           \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 5) ? 5                           \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 6) ? 6                           \
+   : MICRO_ARENA_SIZE_CLASS_FITS(size, 7) ? 7                           \
+   : MICRO_ARENA_SIZE_CLASSES)
+
+// Allocate a T from the pool of its size class, resolved at compile
+// time, or from the arena if it has none. Aligned to
+// MICRO_ARENA_POOL_ALIGNMENT. Free it with MICRO_ARENA_DELETE.
+#define MICRO_ARENA_NEW(ma, T)                                          \
+  ((T*)micro_arena_class_malloc((ma), MICRO_ARENA_SIZE_CLASS(sizeof(T)), \
+                                sizeof(T)))
+#define MICRO_ARENA_DELETE(ma, ptr)                                     \
+  micro_arena_class_free((ma), MICRO_ARENA_SIZE_CLASS(sizeof(*(ptr))),  \
+                         (ptr))
+
+// Region of num_blocks tiny blocks carved from a MicroArena, with
+// one bit per block telling if it is used. The bitmap lives in the
+// same arena allocation, right before the blocks, and is searched
+// 64 blocks at a time. See micro_arena_bitmap_init.
+typedef struct {
+  MicroArena *arena;
+  void *allocation;
+  size_t block_size;
+  size_t num_blocks;
+  size_t num_words;
+  uint64_t *words;  // Bit i of word w is set if block 64 * w + i is used
+  char *blocks;
+  size_t hint;      // No free block before this word
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_t bitmap_mutex;
+  #endif
+} MicroArenaBitmap;
+
+// Stack of blocks in a region carved from a MicroArena, for data
+// freed in the reverse order it was allocated. Each block starts
+// with a MicroArenaStackHeader linking the block below it. Freeing
+// the top block pops it, freeing any other block only marks it and
+// it is popped once it reaches the top. See micro_arena_stack_init.
+typedef struct {
+  MicroArena *arena;
+  void *allocation;
+  char *base;   // Aligned to MICRO_ARENA_STACK_ALIGNMENT
+  size_t size;
+  size_t top;   // Offset of the first free byte
+  size_t last;  // Offset of the header of the top block
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_t stack_mutex;
+  #endif
+} MicroArenaStack;
+
+typedef struct {
+  size_t prev;   // Offset of the header of the block below
+  size_t freed;
+} MicroArenaStackHeader;
+
+// Alignment of the blocks of a MicroArenaStack
+#define MICRO_ARENA_STACK_ALIGNMENT sizeof(MicroArenaStackHeader)
+// MicroArenaStack.last and MicroArenaStackHeader.prev of the bottom
+#define MICRO_ARENA_STACK_EMPTY SIZE_MAX
+
+// Ring of blocks in a region carved from a MicroArena, for data
+// freed in roughly the order it was allocated. Allocation advances
+// head and freeing the oldest block advances tail past it and past
+// the blocks after it that were already freed. A block that does
+// not fit before the end of the region skips the remainder and
+// starts again from the beginning. See micro_arena_ring_init.
+typedef struct {
+  MicroArena *arena;
+  void *allocation;
+  char *base;   // Aligned to MICRO_ARENA_RING_ALIGNMENT
+  size_t size;  // Multiple of MICRO_ARENA_RING_ALIGNMENT
+  size_t head;  // Offset of the next block
+  size_t tail;  // Offset of the oldest block
+  size_t used;  // Bytes between tail and head, headers included
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_t ring_mutex;
+  #endif
+} MicroArenaRing;
+
+typedef struct {
+  size_t span;  // Bytes to the next block, header included
+  size_t freed;
+} MicroArenaRingHeader;
+
+// Alignment of the blocks of a MicroArenaRing
+#define MICRO_ARENA_RING_ALIGNMENT sizeof(MicroArenaRingHeader)
+
+// Linear regions carved from a MicroArena for data that lives for a
+// frame. Allocations bump the top of the current region and are
+// never freed one by one. micro_arena_frame_begin moves to the next
+// region and empties it, so the data of the previous num_regions - 1
+// frames stays readable. See micro_arena_frame_init.
+typedef struct {
+  MicroArena *arena;
+  void *allocation;
+  char *base;          // Aligned to MICRO_ARENA_FRAME_ALIGNMENT
+  size_t region_size;  // Multiple of MICRO_ARENA_FRAME_ALIGNMENT
+  size_t num_regions;
+  size_t current;      // Index of the region of the current frame
+  size_t top;          // Offset of the first free byte in it
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_t frame_mutex;
+  #endif
+} MicroArenaFrame;
+
+// Set of initialized arenas handed out and taken back in O(1), for
+// example one per request of a server. The arenas are provided by
+// the caller so they do not need to live on the stack. Released
+// arenas are emptied and keep their policy and rounding settings.
+// See micro_arena_cache_init.
+typedef struct {
+  MicroArenaInline *arenas;
+  size_t num_arenas;
+  MicroArena *idle[MICRO_ARENA_CACHE_MAX_ARENAS];
+  size_t num_idle;
+  size_t retain;  // Segment bytes kept on release, SIZE_MAX by default
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_t cache_mutex;
+  #endif
+} MicroArenaCache;
+
 //
 // Function declarations
 //
 
+// Make inl->arena manage the MICRO_ARENA_STACK_MEM_SIZE bytes of
+// inl->mem. O(1)
+MICRO_ARENA_DEF void micro_arena_init(MicroArenaInline *inl);
+// Make inl->arena manage the size bytes of buf instead of inl->mem.
+// Returns false if buf is NULL or size is more than
+// MICRO_ARENA_SIZE_MAX. O(1)
+MICRO_ARENA_DEF bool micro_arena_init_buffer(MicroArenaInline *inl,
+                                             void *buf, size_t size);
+// Manage the size bytes of buf, tracking up to max_chunks free and
+// max_chunks used chunks in chunks, an array of 4 * max_chunks
+// MicroArenaSize. This sets the shape of one arena regardless of
+// MICRO_ARENA_STACK_MEM_SIZE and MICRO_ARENA_MAX_NUM_CHUNKS, see also
+// MICRO_ARENA_DEFINE. Returns false if size is more than
+// MICRO_ARENA_SIZE_MAX. O(1)
+MICRO_ARENA_DEF bool micro_arena_init_chunks(MicroArena *ma, void *buf,
+                                             size_t size,
+                                             MicroArenaSize *chunks,
+                                             size_t max_chunks);
+// Initialize child->arena over size bytes allocated from parent, so
+// that micro_arena_free(parent, child->arena.base) frees everything
+// allocated from the child at once. Returns false if the allocation
+// failed. O(parent->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_init_child(MicroArena *parent,
+                                            MicroArenaInline *child,
+                                            size_t size);
+// Let ma grow when it runs out of memory: allocations that do not
+// fit go to segments of at least segment_size bytes, allocated with
+// MICRO_ARENA_BACKING_ALLOC. A segment_size of 0 stops the growth,
+// the existing segments can still be freed into until the arena is
+// reset. Stats and heap maps only describe the memory of ma itself.
+// O(1)
+MICRO_ARENA_DEF void micro_arena_set_growth(MicroArena *ma,
+                                            size_t segment_size);
+// Allocate from the segments of a growable arena, adding a segment
+// if none of them fits. Called by micro_arena_malloc.
+// O(segments * free chunks)
+MICRO_ARENA_DEF void *micro_arena_grow(MicroArena *ma, size_t size);
+// The arena or segment of ma whose memory holds ptr, or NULL.
+// O(segments)
+MICRO_ARENA_DEF MicroArena *micro_arena_segment_of(MicroArena *ma,
+                                                   void *ptr);
+// Free every allocation, as if ma was just initialized over the
+// same memory. The settings, the mutex and the segments are kept.
+// O(segments)
+MICRO_ARENA_DEF void micro_arena_reset(MicroArena *ma);
+// Like micro_arena_reset, but give the newest segments back to
+// MICRO_ARENA_BACKING_FREE until at most bytes of segment memory are
+// left. O(segments)
+MICRO_ARENA_DEF void micro_arena_reset_retain(MicroArena *ma,
+                                              size_t bytes);
+// Give all the segments back and destroy the mutex. The arena must
+// be initialized again before it is used. O(segments)
+MICRO_ARENA_DEF void micro_arena_destroy(MicroArena *ma);
+// Call fn(ctx) when ma is next reset or destroyed, for example to
+// release what the objects allocated in ma own. Callbacks run newest
+// first and may still use the arena. The record is allocated from
+// ma, returns false if it did not fit. O(ma->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_register_cleanup(MicroArena *ma,
+                                                  MicroArenaCleanupFn fn,
+                                                  void *ctx);
+// Run and forget the registered cleanups, newest first. Called by
+// micro_arena_reset, micro_arena_reset_retain and micro_arena_destroy.
+// O(cleanups)
+MICRO_ARENA_DEF void micro_arena_run_cleanups(MicroArena *ma);
+
+#ifdef MICRO_ARENA_TRACE
+// Record the calls of every arena to the file at path, replacing it.
+// Only the outermost call is recorded, not what it does internally.
+// Returns false if already recording or if path can not be opened.
+// O(1)
+MICRO_ARENA_DEF bool micro_arena_trace_start(const char *path);
+// Write the buffered records. O(MICRO_ARENA_TRACE_CAPACITY)
+MICRO_ARENA_DEF void micro_arena_trace_flush(void);
+// Flush and close the file. O(MICRO_ARENA_TRACE_CAPACITY)
+MICRO_ARENA_DEF void micro_arena_trace_stop(void);
+#endif
+// O(1)
+MICRO_ARENA_DEF void micro_arena_set_policy(MicroArena *ma,
+                                            MicroArenaPolicy policy);
 // O(1)
-MICRO_ARENA_DEF void micro_arena_init(MicroArena *ma);
-// First fit. O(ma->free_chunks.len)
+MICRO_ARENA_DEF void micro_arena_set_min_split(MicroArena *ma,
+                                               size_t min_split);
+// A granule of 0 is treated as 1. O(1)
+MICRO_ARENA_DEF void micro_arena_set_rounding(MicroArena *ma,
+                                              MicroArenaRounding rounding,
+                                              size_t granule);
+// Size actually reserved for an allocation of size bytes, before
+// absorbing the remainder of the free chunk. Returns 0 on overflow.
+// O(1)
+MICRO_ARENA_DEF size_t micro_arena_round_size(MicroArena *ma, size_t size);
+// Uses ma->policy. O(ma->free_chunks.len)
 MICRO_ARENA_DEF void *micro_arena_malloc(MicroArena *ma, size_t size);
 // O(max(ma->free_chunks.len, ma->used_chunks.len)
 MICRO_ARENA_DEF void micro_arena_free(MicroArena *ma, void *ptr);
+// Free ptr, allocated with size bytes. The used chunk is looked up
+// from the newest, skipping the chunks smaller than size, which is
+// faster than micro_arena_free when recent allocations are freed
+// first. Same worst case as micro_arena_free.
+MICRO_ARENA_DEF void micro_arena_free_sized(MicroArena *ma, void *ptr,
+                                            size_t size);
 MICRO_ARENA_DEF void *micro_arena_calloc(MicroArena *ma, size_t nmemb, size_t size);
 MICRO_ARENA_DEF void *micro_arena_realloc(MicroArena *ma, void *ptr, size_t size);
 MICRO_ARENA_DEF void *micro_arena_reallocarray(MicroArena *ma, void *ptr,
                                                size_t nmemb, size_t size);
-
+// Allocate size bytes aligned to alignment, a power of two. The
+// padding in front is given back to the arena and the pointer is
+// freed with micro_arena_free. O(ma->free_chunks.len)
+MICRO_ARENA_DEF void *micro_arena_aligned_alloc(MicroArena *ma,
+                                                size_t alignment,
+                                                size_t size);
+// True if ptr points inside the memory of ma or of its segments.
+// O(segments)
+MICRO_ARENA_DEF bool micro_arena_owns(MicroArena *ma, void *ptr);
+// Bytes reserved for the allocation at ptr, at least the size asked
+// for, or 0 if ptr was not returned by ma.
+// O(segments + ma->used_chunks.len)
+MICRO_ARENA_DEF size_t micro_arena_usable_size(MicroArena *ma, void *ptr);
+
+// Use the cap entries of offsets and sizes, the list starts empty.
 // O(1)
 MICRO_ARENA_DEF void
-micro_arena_chunk_list_reset(MicroArenaChunkList *chunk_list);
+micro_arena_chunk_list_init(MicroArenaChunkList *chunk_list,
+                            MicroArenaSize *offsets, MicroArenaSize *sizes,
+                            size_t cap);
 // O(1)
-MICRO_ARENA_DEF MicroArenaChunk*
+MICRO_ARENA_DEF void
+micro_arena_chunk_list_reset(MicroArenaChunkList *chunk_list);
+// Returns false if the list is full or if offset or size do not
+// fit in a MicroArenaSize. O(1)
+MICRO_ARENA_DEF bool
 micro_arena_chunk_list_add(MicroArenaChunkList *chunk_list,
-                           void* start, size_t size);
-// O(chunk_list->len) = O(MICRO_ARENA_MAX_NUM_CHUNKS)
-// May invalidate previous pointers to its items
+                           size_t offset, size_t size);
+// O(chunk_list->len) = O(chunk_list->cap)
+// Shifts the indices of the following items
 MICRO_ARENA_DEF void
 micro_arena_chunk_list_remove(MicroArenaChunkList *chunk_list,
-                              void* start);
-MICRO_ARENA_DEF MicroArenaChunk*
+                              size_t offset);
+MICRO_ARENA_DEF void
+micro_arena_chunk_list_remove_at(MicroArenaChunkList *chunk_list,
+                                 size_t index);
+// Index of the chunk starting at offset, or chunk_list->len if
+// there is none. O(chunk_list->len)
+MICRO_ARENA_DEF size_t
 micro_arena_chunk_list_get(MicroArenaChunkList *chunk_list,
-                           void* start);
+                           size_t offset);
+// Index of the first chunk from index from with a size of at least
+// size bytes, or chunk_list->len if there is none. Uses SIMD when
+// available, comparing 32 / sizeof(MicroArenaSize) sizes at a time
+// with AVX2. O(chunk_list->len)
+MICRO_ARENA_DEF size_t
+micro_arena_chunk_list_find_fit(MicroArenaChunkList *chunk_list,
+                                size_t size, size_t from);
+// Index of the free chunk that ma->policy picks for an allocation
+// of size bytes, or ma->free_chunks.len if none fits.
+// O(ma->free_chunks.len)
+MICRO_ARENA_DEF size_t
+micro_arena_find_free_chunk(MicroArena *ma, size_t size);
+
+// Fill stats with the fragmentation indicators of the arena.
+// O(ma->free_chunks.len + ma->used_chunks.len)
+MICRO_ARENA_DEF void micro_arena_stats(MicroArena *ma, MicroArenaStats *stats);
+// Write an ASCII map of the arena memory in buf, one character per
+// cell of ma->capacity / (buf_len - 1) bytes:
+//
+//   '.' the cell is free
+//   '#' the cell is used
+//   '+' the cell is partially free
+//
+// The map is NUL terminated, returns the number of cells written.
+// O((buf_len - 1) * ma->free_chunks.len)
+MICRO_ARENA_DEF size_t micro_arena_heap_map(MicroArena *ma, char *buf,
+                                            size_t buf_len);
+
+// Initialize a buddy allocator over size bytes of mem. The tags take
+// size / (MICRO_ARENA_BUDDY_MIN_BLOCK + 1) bytes from the front of
+// mem, the rest is split into the biggest blocks that fit aligned to
+// their size.
+// Returns false if not even a minimum block fits. O(size / min block)
+MICRO_ARENA_DEF bool micro_arena_buddy_init(MicroArenaBuddy *buddy,
+                                            void *mem, size_t size);
+// O(MICRO_ARENA_BUDDY_ORDERS)
+MICRO_ARENA_DEF void *micro_arena_buddy_malloc(MicroArenaBuddy *buddy,
+                                               size_t size);
+// O(MICRO_ARENA_BUDDY_ORDERS)
+MICRO_ARENA_DEF void micro_arena_buddy_free(MicroArenaBuddy *buddy,
+                                            void *ptr);
+// Size of the block allocated at ptr, 0 if ptr is not one. O(1)
+MICRO_ARENA_DEF size_t micro_arena_buddy_block_size(MicroArenaBuddy *buddy,
+                                                    void *ptr);
+// Free list helpers of the buddy allocator, offset is relative to
+// buddy->base. O(1)
+MICRO_ARENA_DEF void micro_arena_buddy_push(MicroArenaBuddy *buddy,
+                                            size_t order, size_t offset);
+MICRO_ARENA_DEF void micro_arena_buddy_unlink(MicroArenaBuddy *buddy,
+                                              size_t order, size_t offset);
+
+// Initialize a pool of slots of slot_size bytes and carve its first
+// slab of slots_per_slab slots from ma. If grow is set, a new slab
+// is carved when all slots are taken. Returns false if the slab
+// could not be allocated. O(ma->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_pool_init(MicroArenaPool *pool,
+                                           MicroArena *ma,
+                                           size_t slot_size,
+                                           size_t slots_per_slab,
+                                           bool grow);
+// Carve a new slab from the arena. O(pool->arena->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_pool_add_slab(MicroArenaPool *pool);
+// O(1), or the cost of micro_arena_pool_add_slab when full
+MICRO_ARENA_DEF void *micro_arena_pool_alloc(MicroArenaPool *pool);
+// ptr must come from this pool. O(1)
+MICRO_ARENA_DEF void micro_arena_pool_free(MicroArenaPool *pool, void *ptr);
+// Give all the slabs back to the arena. O(slabs)
+MICRO_ARENA_DEF void micro_arena_pool_destroy(MicroArenaPool *pool);
+
+// Attach size class pools to ma, each carving slabs of
+// slots_per_slab slots on demand. Attach them before the first
+// MICRO_ARENA_NEW and keep them while its objects live. micro_arena_reset
+// empties them with the arena. O(MICRO_ARENA_SIZE_CLASSES)
+MICRO_ARENA_DEF bool
+micro_arena_size_classes_init(MicroArenaSizeClasses *classes,
+                              MicroArena *ma, size_t slots_per_slab);
+// Give the slabs back and detach the pools from the arena.
+// O(slabs)
+MICRO_ARENA_DEF void
+micro_arena_size_classes_destroy(MicroArenaSizeClasses *classes);
+// Allocate size bytes from the pool of size_class, or with
+// micro_arena_aligned_alloc aligned to MICRO_ARENA_POOL_ALIGNMENT if
+// size_class is MICRO_ARENA_SIZE_CLASSES or ma has no size classes.
+// O(1) from a pool
+MICRO_ARENA_DEF void *micro_arena_class_malloc(MicroArena *ma,
+                                               size_t size_class,
+                                               size_t size);
+// Free ptr from micro_arena_class_malloc with the same size_class.
+// O(1) from a pool
+MICRO_ARENA_DEF void micro_arena_class_free(MicroArena *ma,
+                                            size_t size_class, void *ptr);
+
+// Carve num_blocks blocks of block_size bytes and their bitmap from
+// ma. Blocks are aligned to the biggest power of two up to 16 that
+// divides block_size.
+// Returns false if the region could not be allocated.
+// O(ma->free_chunks.len + num_blocks / 64)
+MICRO_ARENA_DEF bool micro_arena_bitmap_init(MicroArenaBitmap *bitmap,
+                                             MicroArena *ma,
+                                             size_t block_size,
+                                             size_t num_blocks);
+// Take the first free block. O(bitmap->num_words), O(1) while the
+// blocks before the hint stay used
+MICRO_ARENA_DEF void *micro_arena_bitmap_alloc(MicroArenaBitmap *bitmap);
+// Pointers that are not the start of a used block are ignored. O(1)
+MICRO_ARENA_DEF void micro_arena_bitmap_free(MicroArenaBitmap *bitmap,
+                                             void *ptr);
+// True if ptr points inside the blocks. O(1)
+MICRO_ARENA_DEF bool micro_arena_bitmap_owns(MicroArenaBitmap *bitmap,
+                                             void *ptr);
+// Give the region back to the arena. O(ma->free_chunks.len)
+MICRO_ARENA_DEF void micro_arena_bitmap_destroy(MicroArenaBitmap *bitmap);
+
+// Carve a stack of size bytes, headers included, from ma. Returns
+// false if the region could not be allocated.
+// O(ma->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_stack_init(MicroArenaStack *stack,
+                                            MicroArena *ma, size_t size);
+// Push a block. O(1)
+MICRO_ARENA_DEF void *micro_arena_stack_alloc(MicroArenaStack *stack,
+                                              size_t size);
+// Pop the block if it is the top one, together with the blocks below
+// it that were already freed. Otherwise the block is popped when it
+// reaches the top. Pointers that are not a live block are ignored.
+// O(blocks above ptr), O(1) amortized for the top block
+MICRO_ARENA_DEF void micro_arena_stack_free(MicroArenaStack *stack,
+                                            void *ptr);
+// Pop every block. O(1)
+MICRO_ARENA_DEF void micro_arena_stack_reset(MicroArenaStack *stack);
+// Give the region back to the arena. O(ma->free_chunks.len)
+MICRO_ARENA_DEF void micro_arena_stack_destroy(MicroArenaStack *stack);
+
+// Carve a ring of size bytes, headers included, from ma. The size is
+// rounded down to MICRO_ARENA_RING_ALIGNMENT. Returns false if the
+// region could not be allocated.
+// O(ma->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_ring_init(MicroArenaRing *ring,
+                                           MicroArena *ma, size_t size);
+// Append a block. The block is always contiguous. O(1)
+MICRO_ARENA_DEF void *micro_arena_ring_alloc(MicroArenaRing *ring,
+                                             size_t size);
+// Release the block. The space is reused once every older block has
+// been released. Pointers that are not a live block are ignored.
+// O(blocks older than ptr), O(1) amortized for the oldest block
+MICRO_ARENA_DEF void micro_arena_ring_free(MicroArenaRing *ring,
+                                           void *ptr);
+// Release every block. O(1)
+MICRO_ARENA_DEF void micro_arena_ring_reset(MicroArenaRing *ring);
+// Give the region back to the arena. O(ma->free_chunks.len)
+MICRO_ARENA_DEF void micro_arena_ring_destroy(MicroArenaRing *ring);
+
+// Carve num_regions regions of region_size bytes from ma, use two for
+// double buffering. region_size is rounded up to
+// MICRO_ARENA_FRAME_ALIGNMENT. The first frame starts in region 0.
+// Returns false if the regions could not be allocated.
+// O(ma->free_chunks.len)
+MICRO_ARENA_DEF bool micro_arena_frame_init(MicroArenaFrame *frame,
+                                            MicroArena *ma,
+                                            size_t region_size,
+                                            size_t num_regions);
+// Start a new frame in the next region, dropping the allocations it
+// held num_regions frames ago. O(1)
+MICRO_ARENA_DEF void micro_arena_frame_begin(MicroArenaFrame *frame);
+// Allocate from the region of the current frame. O(1)
+MICRO_ARENA_DEF void *micro_arena_frame_alloc(MicroArenaFrame *frame,
+                                              size_t size);
+// Give the regions back to the arena. O(ma->free_chunks.len)
+MICRO_ARENA_DEF void micro_arena_frame_destroy(MicroArenaFrame *frame);
+
+// Initialize the num_arenas arenas and make them available. Returns
+// false if num_arenas is 0 or more than MICRO_ARENA_CACHE_MAX_ARENAS.
+// O(num_arenas)
+MICRO_ARENA_DEF bool micro_arena_cache_init(MicroArenaCache *cache,
+                                            MicroArenaInline *arenas,
+                                            size_t num_arenas);
+// Take an empty arena, or NULL if all of them are in use. O(1)
+MICRO_ARENA_DEF MicroArena *micro_arena_cache_acquire(MicroArenaCache *cache);
+// Reset ma, keeping at most cache->retain bytes of its segments, and
+// give it back to the cache. O(1) if ma does not grow
+MICRO_ARENA_DEF void micro_arena_cache_release(MicroArenaCache *cache,
+                                               MicroArena *ma);
+// Keep at most bytes of segment memory in each released arena, 0 to
+// give all the segments back. All are kept by default. O(1)
+MICRO_ARENA_DEF void micro_arena_cache_set_retain(MicroArenaCache *cache,
+                                                  size_t bytes);
+// O(1)
+MICRO_ARENA_DEF void micro_arena_cache_destroy(MicroArenaCache *cache);
+
+// Define the arena type name, with size bytes of memory and room for
+// chunks free and chunks used chunks whatever MICRO_ARENA_STACK_MEM_SIZE
+// and MICRO_ARENA_MAX_NUM_CHUNKS are, and the functions name_init,
+// name_malloc, name_free, name_calloc, name_realloc and name_reset.
+// Any other function takes name_arena(&a). Use it at file scope:
+//
+//     MICRO_ARENA_DEFINE(SmallArena, 512, 16)
+//
+//     SmallArena a;
+//     SmallArena_init(&a);
+//     void *p = SmallArena_malloc(&a, 64);
+//
+#define MICRO_ARENA_DEFINE(name, size, chunks)                          \
+  typedef struct {                                                      \
+    MicroArena arena;                                                   \
+    char mem[size];                                                     \
+    MicroArenaSize chunk_mem[4 * (chunks)];                             \
+  } name;                                                               \
+  typedef char name##_check_size                                        \
+    [((size) <= MICRO_ARENA_SIZE_MAX) ? 1 : -1];                        \
+  static inline MicroArena *name##_arena(name *a)                       \
+  {                                                                     \
+    return &a->arena;                                                   \
+  }                                                                     \
+  static inline void name##_init(name *a)                               \
+  {                                                                     \
+    micro_arena_init_chunks(name##_arena(a), a->mem, (size),            \
+                            a->chunk_mem, (chunks));                    \
+  }                                                                     \
+  static inline void *name##_malloc(name *a, size_t n)                  \
+  {                                                                     \
+    return micro_arena_malloc(name##_arena(a), n);                      \
+  }                                                                     \
+  static inline void name##_free(name *a, void *ptr)                    \
+  {                                                                     \
+    micro_arena_free(name##_arena(a), ptr);                             \
+  }                                                                     \
+  static inline void *name##_calloc(name *a, size_t nmemb, size_t n)    \
+  {                                                                     \
+    return micro_arena_calloc(name##_arena(a), nmemb, n);               \
+  }                                                                     \
+  static inline void *name##_realloc(name *a, void *ptr, size_t n)      \
+  {                                                                     \
+    return micro_arena_realloc(name##_arena(a), ptr, n);                \
+  }                                                                     \
+  static inline void name##_reset(name *a)                              \
+  {                                                                     \
+    micro_arena_reset(name##_arena(a));                                 \
+  }
 
 #ifdef MICRO_ARENA_DEBUG
 
@@ -201,243 +973,2351 @@ MICRO_ARENA_DEF int micro_arena_version(void);
 #include <stdio.h>
 #endif
 
-MICRO_ARENA_DEF void micro_arena_init(MicroArena *ma)
+#ifdef MICRO_ARENA_BACKING_STDLIB
+#include <stdlib.h>
+#endif
+
+#ifdef MICRO_ARENA_TRACE
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+// Not recording while negative
+static int micro_arena_trace_fd = -1;
+static uint64_t micro_arena_trace_epoch;
+static size_t micro_arena_trace_len;
+static MicroArenaTraceRecord
+  micro_arena_trace_records[MICRO_ARENA_TRACE_CAPACITY];
+static uint16_t micro_arena_trace_threads;
+#ifdef MICRO_ARENA_MULTITHREADED
+static pthread_mutex_t micro_arena_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+// Calls of this thread in progress, and its id in the records
+static __thread unsigned micro_arena_trace_depth;
+static __thread uint16_t micro_arena_trace_thread;
+
+#define MICRO_ARENA_TRACE_ENTER() (micro_arena_trace_depth++)
+#define MICRO_ARENA_TRACE_EXIT(op, ptr, result, size, alignment)       \
+  do {                                                                 \
+    if (--micro_arena_trace_depth == 0)                                \
+      micro_arena_trace_record((op), (ptr), (result), (size),          \
+                               (alignment));                           \
+  } while (0)
+
+static uint64_t micro_arena_trace_now(void)
 {
-  if (!ma)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Stops recording if the file can not be written
+static void micro_arena_trace_write(const void *buf, size_t size)
+{
+  const char *bytes = (const char*)buf;
+  while (size > 0 && micro_arena_trace_fd >= 0)
+  {
+    ssize_t written = write(micro_arena_trace_fd, bytes, size);
+    if (written <= 0)
+    {
+      close(micro_arena_trace_fd);
+      __atomic_store_n(&micro_arena_trace_fd, -1, __ATOMIC_RELAXED);
+      return;
+    }
+    bytes += written;
+    size -= (size_t)written;
+  }
+  return;
+}
+
+static void micro_arena_trace_record(MicroArenaTraceOp op, void *ptr,
+                                     void *result, size_t size,
+                                     size_t alignment)
+{
+  if (__atomic_load_n(&micro_arena_trace_fd, __ATOMIC_RELAXED) < 0)
     return;
-  micro_arena_chunk_list_reset(&ma->free_chunks);
-  micro_arena_chunk_list_reset(&ma->used_chunks);
-  micro_arena_chunk_list_add(&ma->free_chunks, &ma->mem,
-                             MICRO_ARENA_STACK_MEM_SIZE);
+  uint64_t now = micro_arena_trace_now();
+
   #ifdef MICRO_ARENA_MULTITHREADED
-  pthread_mutex_init(&ma->arena_mutex, NULL);
+  pthread_mutex_lock(&micro_arena_trace_mutex);
+  #endif
+  if (micro_arena_trace_fd >= 0)
+  {
+    if (micro_arena_trace_thread == 0)
+      micro_arena_trace_thread = ++micro_arena_trace_threads;
+
+    MicroArenaTraceRecord *record =
+      &micro_arena_trace_records[micro_arena_trace_len++];
+    record->time = now - micro_arena_trace_epoch;
+    record->ptr = (uint64_t)(uintptr_t)ptr;
+    record->result = (uint64_t)(uintptr_t)result;
+    record->size = size;
+    record->alignment = (uint32_t)alignment;
+    record->thread = micro_arena_trace_thread;
+    record->op = (uint16_t)op;
+
+    if (micro_arena_trace_len == MICRO_ARENA_TRACE_CAPACITY)
+    {
+      micro_arena_trace_write(micro_arena_trace_records,
+                              sizeof(micro_arena_trace_records));
+      micro_arena_trace_len = 0;
+    }
+  }
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&micro_arena_trace_mutex);
   #endif
   return;
 }
 
-MICRO_ARENA_DEF void *micro_arena_malloc(MicroArena *ma, size_t size)
+MICRO_ARENA_DEF bool micro_arena_trace_start(const char *path)
+{
+  bool started = false;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&micro_arena_trace_mutex);
+  #endif
+  if (micro_arena_trace_fd >= 0 || !path)
+    goto exit;
+
+  micro_arena_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (micro_arena_trace_fd < 0)
+    goto exit;
+  micro_arena_trace_write(MICRO_ARENA_TRACE_MAGIC,
+                          sizeof(MICRO_ARENA_TRACE_MAGIC) - 1);
+  micro_arena_trace_epoch = micro_arena_trace_now();
+  micro_arena_trace_len = 0;
+  started = micro_arena_trace_fd >= 0;
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&micro_arena_trace_mutex);
+  #endif
+  return started;
+}
+
+MICRO_ARENA_DEF void micro_arena_trace_flush(void)
+{
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&micro_arena_trace_mutex);
+  #endif
+  micro_arena_trace_write(micro_arena_trace_records,
+                          micro_arena_trace_len
+                          * sizeof(MicroArenaTraceRecord));
+  micro_arena_trace_len = 0;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&micro_arena_trace_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_trace_stop(void)
+{
+  micro_arena_trace_flush();
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&micro_arena_trace_mutex);
+  #endif
+  if (micro_arena_trace_fd >= 0)
+  {
+    close(micro_arena_trace_fd);
+    __atomic_store_n(&micro_arena_trace_fd, -1, __ATOMIC_RELAXED);
+  }
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&micro_arena_trace_mutex);
+  #endif
+  return;
+}
+#else
+#define MICRO_ARENA_TRACE_ENTER() ((void)0)
+#define MICRO_ARENA_TRACE_EXIT(op, ptr, result, size, alignment) ((void)0)
+#endif // MICRO_ARENA_TRACE
+
+#if !defined(MICRO_ARENA_NO_SIMD) && defined(__GNUC__) \
+  && (MICRO_ARENA_SIZE_MAX <= UINT32_MAX || SIZE_MAX == UINT64_MAX)
+  #if defined(__AVX2__)
+    #define MICRO_ARENA_SIMD_AVX2
+    #include <immintrin.h>
+  #elif defined(__SSE4_2__)
+    #define MICRO_ARENA_SIMD_SSE42
+    #include <nmmintrin.h>
+  #endif
+#endif
+
+MICRO_ARENA_DEF void micro_arena_init(MicroArenaInline *inl)
+{
+  if (!inl)
+    return;
+  #if MICRO_ARENA_STACK_MEM_SIZE > 0 && MICRO_ARENA_MAX_NUM_CHUNKS > 0
+  micro_arena_init_buffer(inl, inl->mem, MICRO_ARENA_STACK_MEM_SIZE);
+  #else
+  micro_arena_init_chunks(&inl->arena, NULL, 0, NULL, 0);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_init_buffer(MicroArenaInline *inl,
+                                             void *buf, size_t size)
+{
+  if (!inl || !buf)
+    return false;
+  #if MICRO_ARENA_MAX_NUM_CHUNKS > 0
+  return micro_arena_init_chunks(&inl->arena, buf, size, inl->chunk_mem,
+                                 MICRO_ARENA_MAX_NUM_CHUNKS);
+  #else
+  return micro_arena_init_chunks(&inl->arena, buf, size, NULL, 0);
+  #endif
+}
+
+MICRO_ARENA_DEF bool micro_arena_init_chunks(MicroArena *ma, void *buf,
+                                             size_t size,
+                                             MicroArenaSize *chunks,
+                                             size_t max_chunks)
+{
+  if (!ma || (!buf && size > 0) || (!chunks && max_chunks > 0)
+      || size > MICRO_ARENA_SIZE_MAX)
+    return false;
+  ma->base = (char*)buf;
+  ma->capacity = size;
+  ma->next = NULL;
+  ma->segment_size = 0;
+  ma->cleanups = NULL;
+  ma->size_classes = NULL;
+  micro_arena_chunk_list_init(&ma->free_chunks, chunks,
+                              chunks + max_chunks, max_chunks);
+  micro_arena_chunk_list_init(&ma->used_chunks, chunks + 2 * max_chunks,
+                              chunks + 3 * max_chunks, max_chunks);
+  if (size > 0)
+    micro_arena_chunk_list_add(&ma->free_chunks, 0, size);
+  ma->policy = MICRO_ARENA_DEFAULT_POLICY;
+  ma->next_fit = 0;
+  ma->min_split = MICRO_ARENA_DEFAULT_MIN_SPLIT;
+  ma->rounding = MICRO_ARENA_DEFAULT_ROUNDING;
+  ma->granule = MICRO_ARENA_DEFAULT_GRANULE;
+  #ifdef MICRO_ARENA_BUDDY
+  micro_arena_buddy_init(&ma->buddy, ma->base, ma->capacity);
+  #endif
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_init(&ma->arena_mutex, NULL);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF bool micro_arena_init_child(MicroArena *parent,
+                                            MicroArenaInline *child,
+                                            size_t size)
+{
+  if (!parent || !child)
+    return false;
+
+  void *buf = micro_arena_malloc(parent, size);
+  if (!buf)
+    return false;
+  if (!micro_arena_init_buffer(child, buf, size))
+  {
+    micro_arena_free(parent, buf);
+    return false;
+  }
+  return true;
+}
+
+MICRO_ARENA_DEF void micro_arena_set_growth(MicroArena *ma,
+                                            size_t segment_size)
 {
+  if (!ma)
+    return;
+
   #ifdef MICRO_ARENA_MULTITHREADED
   pthread_mutex_lock(&ma->arena_mutex);
   #endif
-  
-  #ifdef MICRO_ARENA_DEBUG
-  printf("DEBUG: micro_arena_malloc: called with size %ld\n", size);
+  ma->segment_size = segment_size;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
   #endif
+  return;
+}
 
+MICRO_ARENA_DEF void *micro_arena_grow(MicroArena *ma, size_t size)
+{
   if (!ma)
-    goto exit;
+    return NULL;
 
-  for (size_t i = 0; i < ma->free_chunks.len; ++i)
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+
+  void *ptr = NULL;
+  size_t bytes, chunks;
+  MicroArena *segment;
+  for (segment = ma->next; segment; segment = segment->next)
   {
-    if (ma->free_chunks.chunks[i].size < size)
-      continue;
+    ptr = micro_arena_malloc(segment, size);
+    if (ptr)
+      goto exit;
+  }
+  if (ma->segment_size == 0)
+    goto exit;
 
-    MicroArenaChunk *used_chunk =
-      micro_arena_chunk_list_add(&ma->used_chunks,
-                                 ma->free_chunks.chunks[i].start,
-                                 size);
-    if (!used_chunk)
+  #ifdef MICRO_ARENA_BUDDY
+  // Room for a block of the next power of two aligned to its size,
+  // with the tags in front and the alignment of the first block
+  for (bytes = MICRO_ARENA_BUDDY_MIN_BLOCK; bytes < size; bytes *= 2)
+    if (bytes > SIZE_MAX / 4 / (MICRO_ARENA_BUDDY_MIN_BLOCK + 1))
       goto exit;
-    
-    ma->free_chunks.chunks[i].start = ma->free_chunks.chunks[i].start + size;
-    ma->free_chunks.chunks[i].size = ma->free_chunks.chunks[i].size - size;
+  bytes = (2 * bytes / MICRO_ARENA_BUDDY_MIN_BLOCK + 1)
+    * (MICRO_ARENA_BUDDY_MIN_BLOCK + 1) + MICRO_ARENA_BUDDY_MIN_BLOCK;
+  #else
+  bytes = micro_arena_round_size(ma, size);
+  if (bytes == 0 && size > 0)
+    goto exit;
+  #endif
+  if (bytes < ma->segment_size)
+    bytes = ma->segment_size;
+  if (bytes > MICRO_ARENA_SIZE_MAX)
+    goto exit;
 
-    #ifdef MICRO_ARENA_MULTITHREADED
-    pthread_mutex_unlock(&ma->arena_mutex);
-    #endif
-    return (void*)used_chunk->start;
+  // A segment is its MicroArena, the chunk tables with as many
+  // entries as ma, then the memory
+  chunks = 4 * ma->free_chunks.cap * sizeof(MicroArenaSize);
+  if (bytes > SIZE_MAX - sizeof(MicroArena) - chunks)
+    goto exit;
+  segment = (MicroArena*)
+    MICRO_ARENA_BACKING_ALLOC(sizeof(MicroArena) + chunks + bytes);
+  if (!segment)
+    goto exit;
+  if (!micro_arena_init_chunks(segment, (char*)(segment + 1) + chunks, bytes,
+                               (MicroArenaSize*)(segment + 1),
+                               ma->free_chunks.cap))
+  {
+    MICRO_ARENA_BACKING_FREE(segment, sizeof(MicroArena) + chunks + bytes);
+    goto exit;
   }
+  segment->policy = ma->policy;
+  segment->min_split = ma->min_split;
+  segment->rounding = ma->rounding;
+  segment->granule = ma->granule;
+  segment->next = ma->next;
+  ma->next = segment;
+
+  ptr = micro_arena_malloc(segment, size);
 
  exit:
   #ifdef MICRO_ARENA_MULTITHREADED
   pthread_mutex_unlock(&ma->arena_mutex);
   #endif
+  return ptr;
+}
+
+// micro_arena_segment_of with the mutex of ma already held
+static MicroArena *micro_arena_segment_of_locked(MicroArena *ma, void *ptr)
+{
+  for (; ma; ma = ma->next)
+  {
+    // Zero sized allocations may point at the end of the memory
+    if ((char*)ptr >= ma->base && (char*)ptr <= ma->base + ma->capacity)
+      return ma;
+  }
   return NULL;
 }
 
-MICRO_ARENA_DEF void micro_arena_free(MicroArena *ma, void *ptr)
+MICRO_ARENA_DEF MicroArena *micro_arena_segment_of(MicroArena *ma,
+                                                   void *ptr)
 {
+  if (!ma)
+    return NULL;
+
+  // micro_arena_grow links new segments with the mutex held
   #ifdef MICRO_ARENA_MULTITHREADED
-  pthread_mutex_unlock(&ma->arena_mutex);
+  pthread_mutex_lock(&ma->arena_mutex);
   #endif
-  
-  #ifdef MICRO_ARENA_DEBUG
-  printf("DEBUG: micro_arena_free: called with ptr %p\n", ptr);
+  MicroArena *segment = micro_arena_segment_of_locked(ma, ptr);
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
   #endif
+  return segment;
+}
+
+MICRO_ARENA_DEF void micro_arena_reset(MicroArena *ma)
+{
+  micro_arena_reset_retain(ma, SIZE_MAX);
+  return;
+}
 
+MICRO_ARENA_DEF void micro_arena_reset_retain(MicroArena *ma,
+                                              size_t bytes)
+{
   if (!ma)
-    goto exit;
-  
-  MicroArenaChunk *used_chunk =
-    micro_arena_chunk_list_get(&ma->used_chunks, ptr);
-  if (!used_chunk)
-    goto exit;
+    return;
 
-  #ifdef MICRO_ARENA_DEBUG
-  printf("DEBUG: micro_arena_free: used chunk start = %p, size = %ld\n",
-         (void*)used_chunk->start,
-         used_chunk->size);
+  // The records of the cleanups are freed below
+  micro_arena_run_cleanups(ma);
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
   #endif
 
-  MicroArenaChunk *free_chunk_after = NULL;
-  MicroArenaChunk *free_chunk_before = NULL;
-  for (size_t i = 0; i < ma->free_chunks.len; ++i)
-  {
-    if (ma->free_chunks.chunks[i].start ==
-        used_chunk->start + used_chunk->size)
-      free_chunk_after = &ma->free_chunks.chunks[i];
-    if (used_chunk->start ==
-        ma->free_chunks.chunks[i].start + ma->free_chunks.chunks[i].size)
-      free_chunk_before = &ma->free_chunks.chunks[i];
-  }
+  // Keep the oldest segments, they are at the end of the list
+  size_t total = 0;
+  for (MicroArena *segment = ma->next; segment; segment = segment->next)
+    total += segment->capacity;
 
-  if (free_chunk_before && free_chunk_after)
-  {
-    #ifdef MICRO_ARENA_DEBUG
-    printf("DEBUG: micro_arena_free: free chunks were found before and after ptr\n");
-    #endif
-    free_chunk_before->size += used_chunk->size + free_chunk_after->size;
-    micro_arena_chunk_list_remove(&ma->used_chunks, used_chunk->start);
-    micro_arena_chunk_list_remove(&ma->free_chunks, free_chunk_before->start);
-    goto exit;
-  }
-  if (free_chunk_before)
+  MicroArena **link = &ma->next;
+  while (*link)
   {
-    #ifdef MICRO_ARENA_DEBUG
-    printf("DEBUG: micro_arena_free: free chunks were found before ptr\n");
-    #endif
-    free_chunk_before->size += used_chunk->size;
-    micro_arena_chunk_list_remove(&ma->used_chunks, used_chunk->start);
-    goto exit;
+    MicroArena *segment = *link;
+    if (total <= bytes)
+    {
+      micro_arena_reset(segment);
+      link = &segment->next;
+      continue;
+    }
+    total -= segment->capacity;
+    *link = segment->next;
+    segment->next = NULL;
+    micro_arena_destroy(segment);
+    MICRO_ARENA_BACKING_FREE(segment, sizeof(MicroArena)
+                             + 4 * segment->free_chunks.cap
+                             * sizeof(MicroArenaSize)
+                             + segment->capacity);
   }
-  if (free_chunk_after)
+
+  micro_arena_chunk_list_reset(&ma->free_chunks);
+  micro_arena_chunk_list_reset(&ma->used_chunks);
+  if (ma->capacity > 0)
+    micro_arena_chunk_list_add(&ma->free_chunks, 0, ma->capacity);
+  ma->next_fit = 0;
+  #ifdef MICRO_ARENA_BUDDY
+  micro_arena_buddy_init(&ma->buddy, ma->base, ma->capacity);
+  #endif
+
+  // The slabs of the size classes were freed with the rest
+  if (ma->size_classes)
   {
-    #ifdef MICRO_ARENA_DEBUG
-    printf("DEBUG: micro_arena_free: free chunks were found after ptr\n");
-    #endif
-    free_chunk_after->start = used_chunk->start;
-    free_chunk_after->size += used_chunk->size;
-    micro_arena_chunk_list_remove(&ma->used_chunks, used_chunk->start);
-    goto exit;
+    for (size_t i = 0; i < MICRO_ARENA_SIZE_CLASSES; ++i)
+    {
+      MicroArenaPool *pool = &ma->size_classes->pools[i];
+      pool->free_list = NULL;
+      pool->slabs = NULL;
+      pool->bump = NULL;
+      pool->bump_end = NULL;
+    }
   }
 
-  #ifdef MICRO_ARENA_DEBUG
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_destroy(MicroArena *ma)
+{
+  if (!ma)
+    return;
+
+  micro_arena_reset_retain(ma, 0);
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_register_cleanup(MicroArena *ma,
+                                                  MicroArenaCleanupFn fn,
+                                                  void *ctx)
+{
+  if (!ma || !fn)
+    return false;
+
+  // Aligned like small objects so that they do not need padding
+  MicroArenaCleanup *cleanup = (MicroArenaCleanup*)
+    micro_arena_aligned_alloc(ma, MICRO_ARENA_POOL_ALIGNMENT,
+                              sizeof(MicroArenaCleanup));
+  if (!cleanup)
+    return false;
+  cleanup->fn = fn;
+  cleanup->ctx = ctx;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+  cleanup->next = ma->cleanups;
+  ma->cleanups = cleanup;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF void micro_arena_run_cleanups(MicroArena *ma)
+{
+  if (!ma)
+    return;
+
+  for (;;)
+  {
+    #ifdef MICRO_ARENA_MULTITHREADED
+    pthread_mutex_lock(&ma->arena_mutex);
+    #endif
+    MicroArenaCleanup *cleanup = ma->cleanups;
+    if (cleanup)
+      ma->cleanups = cleanup->next;
+    #ifdef MICRO_ARENA_MULTITHREADED
+    pthread_mutex_unlock(&ma->arena_mutex);
+    #endif
+
+    if (!cleanup)
+      break;
+    // Outside the lock, the callback may use the arena
+    cleanup->fn(cleanup->ctx);
+  }
+  return;
+}
+
+static void *micro_arena_malloc_untraced(MicroArena *ma, size_t size)
+{
+  if (!ma)
+    return NULL;
+
+  bool grows;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+  
+  #ifdef MICRO_ARENA_DEBUG
+  printf("DEBUG: micro_arena_malloc: called with size %ld\n", size);
+  #endif
+
+  #ifdef MICRO_ARENA_BUDDY
+  void *block = micro_arena_buddy_malloc(&ma->buddy, size);
+  if (!block)
+    goto exit;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return block;
+  #else
+
+  size_t i;
+  size_t rounded = micro_arena_round_size(ma, size);
+  if (rounded < size)
+    goto exit;
+  size = rounded;
+
+  i = micro_arena_find_free_chunk(ma, size);
+  if (i < ma->free_chunks.len)
+  {
+    size_t offset = ma->free_chunks.offsets[i];
+    size_t remainder = ma->free_chunks.sizes[i] - size;
+    if (remainder < ma->min_split)
+    {
+      size += remainder;
+      remainder = 0;
+    }
+
+    if (!micro_arena_chunk_list_add(&ma->used_chunks, offset, size))
+      goto exit;
+    
+    if (remainder == 0)
+    {
+      micro_arena_chunk_list_remove_at(&ma->free_chunks, i);
+    }
+    else
+    {
+      ma->free_chunks.offsets[i] = (MicroArenaSize)(offset + size);
+      ma->free_chunks.sizes[i] = (MicroArenaSize)remainder;
+    }
+    ma->next_fit = i;
+
+    #ifdef MICRO_ARENA_MULTITHREADED
+    pthread_mutex_unlock(&ma->arena_mutex);
+    #endif
+    return (void*)(ma->base + offset);
+  }
+  #endif // MICRO_ARENA_BUDDY
+
+ exit:
+  // Read with the mutex held, micro_arena_set_growth may change it
+  grows = ma->segment_size > 0;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  if (grows)
+    return micro_arena_grow(ma, size);
+  return NULL;
+}
+
+MICRO_ARENA_DEF void *micro_arena_malloc(MicroArena *ma, size_t size)
+{
+  MICRO_ARENA_TRACE_ENTER();
+  void *result = micro_arena_malloc_untraced(ma, size);
+  MICRO_ARENA_TRACE_EXIT(MICRO_ARENA_TRACE_MALLOC, NULL, result, size, 0);
+  return result;
+}
+
+MICRO_ARENA_DEF void micro_arena_set_policy(MicroArena *ma,
+                                            MicroArenaPolicy policy)
+{
+  if (!ma)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+
+  ma->policy = policy;
+  ma->next_fit = 0;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_set_min_split(MicroArena *ma,
+                                               size_t min_split)
+{
+  if (!ma)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+
+  ma->min_split = min_split;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_set_rounding(MicroArena *ma,
+                                              MicroArenaRounding rounding,
+                                              size_t granule)
+{
+  if (!ma)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+
+  ma->rounding = rounding;
+  ma->granule = (granule == 0) ? 1 : granule;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF size_t micro_arena_round_size(MicroArena *ma, size_t size)
+{
+  if (!ma || size == 0)
+    return size;
+
+  size_t step = ma->granule;
+  switch (ma->rounding)
+  {
+  case MICRO_ARENA_ROUND_GRANULE:
+    break;
+  case MICRO_ARENA_ROUND_GEOMETRIC:
+    {
+      // A quarter of the biggest power of two below size
+      size_t power = 1;
+      while (power <= (size - 1) / 2)
+        power *= 2;
+      if (power / 4 > step)
+        step = power / 4;
+    }
+    break;
+  case MICRO_ARENA_ROUND_NONE:
+  default:
+    return size;
+  }
+
+  if (size > SIZE_MAX - (step - 1))
+    return 0;
+  return (size + step - 1) / step * step;
+}
+
+MICRO_ARENA_DEF size_t
+micro_arena_find_free_chunk(MicroArena *ma, size_t size)
+{
+  if (!ma)
+    return 0;
+
+  MicroArenaChunkList *free_chunks = &ma->free_chunks;
+  size_t found = free_chunks->len;
+
+  switch (ma->policy)
+  {
+  case MICRO_ARENA_NEXT_FIT:
+    // The index may be stale after a removal, it is only a hint
+    if (ma->next_fit < free_chunks->len)
+    {
+      found = micro_arena_chunk_list_find_fit(free_chunks, size,
+                                              ma->next_fit);
+      if (found < free_chunks->len)
+        return found;
+    }
+    return micro_arena_chunk_list_find_fit(free_chunks, size, 0);
+  case MICRO_ARENA_BEST_FIT:
+    for (size_t i = 0; i < free_chunks->len; ++i)
+    {
+      if (free_chunks->sizes[i] < size)
+        continue;
+      if (found == free_chunks->len
+          || free_chunks->sizes[i] < free_chunks->sizes[found])
+        found = i;
+      if (free_chunks->sizes[i] == size)
+        break;
+    }
+    break;
+  case MICRO_ARENA_WORST_FIT:
+    for (size_t i = 0; i < free_chunks->len; ++i)
+    {
+      if (free_chunks->sizes[i] < size)
+        continue;
+      if (found == free_chunks->len
+          || free_chunks->sizes[i] > free_chunks->sizes[found])
+        found = i;
+    }
+    break;
+  case MICRO_ARENA_ADDRESS_ORDERED_FIT:
+    for (size_t i = 0; i < free_chunks->len; ++i)
+    {
+      if (free_chunks->sizes[i] < size)
+        continue;
+      if (found == free_chunks->len
+          || free_chunks->offsets[i] < free_chunks->offsets[found])
+        found = i;
+    }
+    break;
+  case MICRO_ARENA_FIRST_FIT:
+  default:
+    return micro_arena_chunk_list_find_fit(free_chunks, size, 0);
+  }
+
+  return found;
+}
+
+// Index of the used chunk at offset, which holds at least size
+// bytes, searching from the newest chunk
+static size_t micro_arena_used_index_sized(MicroArenaChunkList *used,
+                                           size_t offset, size_t size)
+{
+  for (size_t i = used->len; i > 0; --i)
+  {
+    if (used->sizes[i - 1] >= size && used->offsets[i - 1] == offset)
+      return i - 1;
+  }
+  return used->len;
+}
+
+// Without sized, size_hint is ignored
+static void micro_arena_free_untraced(MicroArena *ma, void *ptr,
+                                      size_t size_hint, bool sized)
+{
+  if (!ma)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+  
+  #ifdef MICRO_ARENA_DEBUG
+  printf("DEBUG: micro_arena_free: called with ptr %p\n", ptr);
+  #endif
+
+  size_t start, used_index, size, after, before;
+  MicroArena *segment = micro_arena_segment_of_locked(ma, ptr);
+  if (!segment)
+    goto exit;
+  if (segment != ma)
+  {
+    micro_arena_free_untraced(segment, ptr, size_hint, sized);
+    goto exit;
+  }
+
+  #ifdef MICRO_ARENA_BUDDY
+  micro_arena_buddy_free(&ma->buddy, ptr);
+  goto exit;
+  #endif
+  
+  start = (size_t)((char*)ptr - ma->base);
+  used_index = sized
+    ? micro_arena_used_index_sized(&ma->used_chunks, start, size_hint)
+    : micro_arena_chunk_list_get(&ma->used_chunks, start);
+  if (used_index >= ma->used_chunks.len)
+    goto exit;
+  size = ma->used_chunks.sizes[used_index];
+
+  #ifdef MICRO_ARENA_DEBUG
+  printf("DEBUG: micro_arena_free: used chunk offset = %ld, size = %ld\n",
+         start, size);
+  #endif
+
+  after = ma->free_chunks.len;
+  before = ma->free_chunks.len;
+  for (size_t i = 0; i < ma->free_chunks.len; ++i)
+  {
+    if (ma->free_chunks.offsets[i] == start + size)
+      after = i;
+    if (start == (size_t)ma->free_chunks.offsets[i] + ma->free_chunks.sizes[i])
+      before = i;
+  }
+
+  if (before < ma->free_chunks.len && after < ma->free_chunks.len)
+  {
+    #ifdef MICRO_ARENA_DEBUG
+    printf("DEBUG: micro_arena_free: free chunks were found before and after ptr\n");
+    #endif
+    ma->free_chunks.sizes[before] = (MicroArenaSize)
+      (ma->free_chunks.sizes[before] + size + ma->free_chunks.sizes[after]);
+    micro_arena_chunk_list_remove_at(&ma->used_chunks, used_index);
+    micro_arena_chunk_list_remove_at(&ma->free_chunks, after);
+    goto exit;
+  }
+  if (before < ma->free_chunks.len)
+  {
+    #ifdef MICRO_ARENA_DEBUG
+    printf("DEBUG: micro_arena_free: free chunks were found before ptr\n");
+    #endif
+    ma->free_chunks.sizes[before] =
+      (MicroArenaSize)(ma->free_chunks.sizes[before] + size);
+    micro_arena_chunk_list_remove_at(&ma->used_chunks, used_index);
+    goto exit;
+  }
+  if (after < ma->free_chunks.len)
+  {
+    #ifdef MICRO_ARENA_DEBUG
+    printf("DEBUG: micro_arena_free: free chunks were found after ptr\n");
+    #endif
+    ma->free_chunks.offsets[after] = (MicroArenaSize)start;
+    ma->free_chunks.sizes[after] =
+      (MicroArenaSize)(ma->free_chunks.sizes[after] + size);
+    micro_arena_chunk_list_remove_at(&ma->used_chunks, used_index);
+    goto exit;
+  }
+
+  #ifdef MICRO_ARENA_DEBUG
   printf("DEBUG: micro_arena_free: no free chunks found before or after prt\n");
   #endif
 
-  micro_arena_chunk_list_add(&ma->free_chunks,
-                             used_chunk->start,
-                             used_chunk->size);
-  micro_arena_chunk_list_remove(&ma->used_chunks, used_chunk->start);
+  micro_arena_chunk_list_add(&ma->free_chunks, start, size);
+  micro_arena_chunk_list_remove_at(&ma->used_chunks, used_index);
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_free(MicroArena *ma, void *ptr)
+{
+  MICRO_ARENA_TRACE_ENTER();
+  micro_arena_free_untraced(ma, ptr, 0, false);
+  MICRO_ARENA_TRACE_EXIT(MICRO_ARENA_TRACE_FREE, ptr, NULL, 0, 0);
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_free_sized(MicroArena *ma, void *ptr,
+                                            size_t size)
+{
+  MICRO_ARENA_TRACE_ENTER();
+  micro_arena_free_untraced(ma, ptr, size, true);
+  MICRO_ARENA_TRACE_EXIT(MICRO_ARENA_TRACE_FREE, ptr, NULL, 0, 0);
+  return;
+}
+
+MICRO_ARENA_DEF void *micro_arena_calloc(MicroArena *ma, size_t nmemb, size_t size)
+{
+  if (!ma || (size > 0 && nmemb > SIZE_MAX / size))
+    return NULL;
+
+  char* mem = (char*)micro_arena_malloc(ma, size * nmemb);
+  if (!mem)
+    return NULL;
+
+  for (size_t i = 0; i < nmemb * size; ++i)
+    mem[i] = 0;
+
+  return mem;
+}
+
+// Size of the live block at ptr, read under the lock of its segment.
+// Returns false if ptr is not a block of ma.
+static bool micro_arena_block_size(MicroArena *ma, void *ptr, size_t *size)
+{
+  MicroArena *segment = micro_arena_segment_of(ma, ptr);
+  if (!segment)
+    return false;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&segment->arena_mutex);
+  #endif
+  #ifdef MICRO_ARENA_BUDDY
+  *size = micro_arena_buddy_block_size(&segment->buddy, ptr);
+  bool found = *size > 0;
+  #else
+  size_t i = micro_arena_chunk_list_get(&segment->used_chunks,
+                                        (size_t)((char*)ptr - segment->base));
+  bool found = i < segment->used_chunks.len;
+  *size = found ? segment->used_chunks.sizes[i] : 0;
+  #endif
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&segment->arena_mutex);
+  #endif
+  return found;
+}
+
+static void *micro_arena_realloc_untraced(MicroArena *ma, void *ptr,
+                                          size_t size)
+{
+  if (!ma)
+    return NULL;
+
+  if (ptr == NULL)
+    return micro_arena_malloc(ma, size);
+
+  size_t old_size;
+  if (!micro_arena_block_size(ma, ptr, &old_size))
+    return NULL;
+
+  char* mem = (char*)micro_arena_malloc(ma, size);
+  if (!mem)
+    return NULL;
+
+  size_t min_size = (old_size < size) ? old_size : size;
+  for (size_t i = 0; i < min_size; ++i)
+    mem[i] = ((char*)ptr)[i];
+
+  micro_arena_free(ma, ptr);
+  return mem;
+}
+
+MICRO_ARENA_DEF void *micro_arena_realloc(MicroArena *ma, void *ptr, size_t size)
+{
+  MICRO_ARENA_TRACE_ENTER();
+  void *result = micro_arena_realloc_untraced(ma, ptr, size);
+  MICRO_ARENA_TRACE_EXIT(MICRO_ARENA_TRACE_REALLOC, ptr, result, size, 0);
+  return result;
+}
+
+MICRO_ARENA_DEF void *micro_arena_reallocarray(MicroArena *ma, void *ptr,
+                                               size_t nmemb, size_t size)
+{
+  if (size > 0 && nmemb > SIZE_MAX / size)
+    return NULL;
+  return micro_arena_realloc(ma, ptr, nmemb * size);
+}
+
+static void *micro_arena_aligned_alloc_untraced(MicroArena *ma,
+                                                 size_t alignment,
+                                                 size_t size)
+{
+  if (!ma || alignment == 0 || (alignment & (alignment - 1)) != 0
+      || alignment > SIZE_MAX / 4 || size > SIZE_MAX / 2)
+    return NULL;
+
+  #ifdef MICRO_ARENA_BUDDY
+  // Blocks are aligned to their size, a block of alignment bytes is
+  // enough. Only an alignment above the biggest block fails.
+  char *ptr = (char*)micro_arena_malloc(ma, size < alignment
+                                        ? alignment : size);
+  if (ptr && (uintptr_t)ptr % alignment != 0)
+  {
+    micro_arena_free(ma, ptr);
+    ptr = NULL;
+  }
+  return ptr;
+  #else
+  // Whole multiples of the alignment keep the next allocation aligned
+  size = (size + alignment - 1) / alignment * alignment;
+  char *ptr = (char*)micro_arena_malloc(ma, size + alignment - 1);
+  if (!ptr)
+    return NULL;
+  size_t pad = (alignment - (uintptr_t)ptr % alignment) % alignment;
+
+  MicroArena *segment = micro_arena_segment_of(ma, ptr);
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&segment->arena_mutex);
+  #endif
+  MicroArenaChunkList *used = &segment->used_chunks;
+  MicroArenaChunkList *free_chunks = &segment->free_chunks;
+  size_t offset = (size_t)(ptr - segment->base);
+  // The chunk was just appended, unless another thread was faster
+  size_t i = (used->len > 0 && used->offsets[used->len - 1] == offset)
+    ? used->len - 1 : micro_arena_chunk_list_get(used, offset);
+  size_t chunk_size = used->sizes[i];
+
+  // Give the tail past the aligned end back to the free chunk after
+  // it, which is there unless the chunk was taken whole
+  size_t tail = chunk_size - pad - size;
+  for (size_t j = 0; tail > 0 && j < free_chunks->len; ++j)
+  {
+    if (free_chunks->offsets[j] != offset + chunk_size)
+      continue;
+    free_chunks->offsets[j] = (MicroArenaSize)(offset + pad + size);
+    free_chunks->sizes[j] = (MicroArenaSize)(free_chunks->sizes[j] + tail);
+    chunk_size -= tail;
+    used->sizes[i] = (MicroArenaSize)chunk_size;
+    break;
+  }
+  if (pad == 0)
+  {
+    #ifdef MICRO_ARENA_MULTITHREADED
+    pthread_mutex_unlock(&segment->arena_mutex);
+    #endif
+    return ptr;
+  }
+
+  // Split the padding into its own used chunk and free it
+  segment->used_chunks.sizes[i] = (MicroArenaSize)pad;
+  bool split = micro_arena_chunk_list_add(&segment->used_chunks,
+                                          offset + pad, chunk_size - pad);
+  if (!split)
+    segment->used_chunks.sizes[i] = (MicroArenaSize)chunk_size;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&segment->arena_mutex);
+  #endif
+
+  micro_arena_free(segment, ptr);
+  return split ? ptr + pad : NULL;
+  #endif // MICRO_ARENA_BUDDY
+}
+
+MICRO_ARENA_DEF void *micro_arena_aligned_alloc(MicroArena *ma,
+                                                size_t alignment,
+                                                size_t size)
+{
+  MICRO_ARENA_TRACE_ENTER();
+  void *result = micro_arena_aligned_alloc_untraced(ma, alignment, size);
+  MICRO_ARENA_TRACE_EXIT(MICRO_ARENA_TRACE_ALIGNED_ALLOC, NULL, result,
+                         size, alignment);
+  return result;
+}
+
+MICRO_ARENA_DEF bool micro_arena_owns(MicroArena *ma, void *ptr)
+{
+  return micro_arena_segment_of(ma, ptr) != NULL;
+}
+
+MICRO_ARENA_DEF size_t micro_arena_usable_size(MicroArena *ma, void *ptr)
+{
+  size_t size;
+  if (!micro_arena_block_size(ma, ptr, &size))
+    return 0;
+  return size;
+}
+
+MICRO_ARENA_DEF void micro_arena_stats(MicroArena *ma, MicroArenaStats *stats)
+{
+  if (!stats)
+    return;
+  static MicroArenaStats empty_stats;
+  *stats = empty_stats;
+  if (!ma)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+
+  for (size_t i = 0; i < ma->free_chunks.len; ++i)
+  {
+    size_t size = ma->free_chunks.sizes[i];
+    if (size == 0)
+      continue;
+
+    stats->total_free += size;
+    stats->free_chunks++;
+    if (size > stats->largest_free)
+      stats->largest_free = size;
+
+    size_t bucket = 0;
+    while (size >>= 1)
+      bucket++;
+    if (bucket >= MICRO_ARENA_STATS_BUCKETS)
+      bucket = MICRO_ARENA_STATS_BUCKETS - 1;
+    stats->histogram[bucket]++;
+  }
+
+  for (size_t i = 0; i < ma->used_chunks.len; ++i)
+    stats->total_used += ma->used_chunks.sizes[i];
+  stats->used_chunks = ma->used_chunks.len;
+
+  if (stats->total_free > 0)
+  {
+    stats->fragmentation =
+      1.0 - (double)stats->largest_free / (double)stats->total_free;
+    stats->average_hole =
+      (double)stats->total_free / (double)stats->free_chunks;
+  }
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF size_t micro_arena_heap_map(MicroArena *ma, char *buf,
+                                            size_t buf_len)
+{
+  if (!buf || buf_len == 0)
+    return 0;
+  buf[0] = '\0';
+  if (!ma)
+    return 0;
+
+  size_t cells = buf_len - 1;
+  if (cells > ma->capacity)
+    cells = ma->capacity;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+
+  for (size_t c = 0; c < cells; ++c)
+  {
+    size_t cell_start = c * ma->capacity / cells;
+    size_t cell_end = (c + 1) * ma->capacity / cells;
+
+    size_t free_bytes = 0;
+    for (size_t i = 0; i < ma->free_chunks.len; ++i)
+    {
+      size_t start = ma->free_chunks.offsets[i];
+      size_t end = start + ma->free_chunks.sizes[i];
+      if (start < cell_start)
+        start = cell_start;
+      if (end > cell_end)
+        end = cell_end;
+      if (start < end)
+        free_bytes += end - start;
+    }
+
+    if (free_bytes == 0)
+      buf[c] = '#';
+    else if (free_bytes == cell_end - cell_start)
+      buf[c] = '.';
+    else
+      buf[c] = '+';
+  }
+  buf[cells] = '\0';
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return cells;
+}
+
+// Free blocks of the buddy allocator are linked in both directions
+// so that a buddy can be taken out of its list when merging
+typedef struct MicroArenaBuddyBlock {
+  struct MicroArenaBuddyBlock *next;
+  struct MicroArenaBuddyBlock *prev;
+} MicroArenaBuddyBlock;
+
+#define MICRO_ARENA_BUDDY_FREE 0x80
+
+MICRO_ARENA_DEF void micro_arena_buddy_push(MicroArenaBuddy *buddy,
+                                            size_t order, size_t offset)
+{
+  MicroArenaBuddyBlock *block = (MicroArenaBuddyBlock*)(buddy->base + offset);
+  block->prev = NULL;
+  block->next = (MicroArenaBuddyBlock*)buddy->free_lists[order];
+  if (block->next)
+    block->next->prev = block;
+  buddy->free_lists[order] = block;
+  buddy->tags[offset / MICRO_ARENA_BUDDY_MIN_BLOCK] =
+    (unsigned char)((order + 1) | MICRO_ARENA_BUDDY_FREE);
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_buddy_unlink(MicroArenaBuddy *buddy,
+                                              size_t order, size_t offset)
+{
+  MicroArenaBuddyBlock *block = (MicroArenaBuddyBlock*)(buddy->base + offset);
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    buddy->free_lists[order] = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  buddy->tags[offset / MICRO_ARENA_BUDDY_MIN_BLOCK] = 0;
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_buddy_init(MicroArenaBuddy *buddy,
+                                            void *mem, size_t size)
+{
+  if (!buddy)
+    return false;
+
+  // Without memory the allocator is empty, every malloc fails
+  buddy->tags = NULL;
+  buddy->base = NULL;
+  buddy->size = 0;
+  for (size_t k = 0; k < MICRO_ARENA_BUDDY_ORDERS; ++k)
+    buddy->free_lists[k] = NULL;
+  if (!mem)
+    return false;
+
+  // Tags in front, then as many aligned minimum blocks as fit
+  size_t blocks = size / (MICRO_ARENA_BUDDY_MIN_BLOCK + 1);
+  char *base = NULL;
+  for (;; --blocks)
+  {
+    if (blocks == 0)
+      return false;
+    uintptr_t end = (uintptr_t)mem + blocks;
+    uintptr_t aligned = (end + MICRO_ARENA_BUDDY_MIN_BLOCK - 1)
+      / MICRO_ARENA_BUDDY_MIN_BLOCK * MICRO_ARENA_BUDDY_MIN_BLOCK;
+    base = (char*)mem + (aligned - (uintptr_t)mem);
+    if (base + blocks * MICRO_ARENA_BUDDY_MIN_BLOCK <= (char*)mem + size)
+      break;
+  }
+
+  buddy->tags = (unsigned char*)mem;
+  buddy->base = base;
+  buddy->size = blocks * MICRO_ARENA_BUDDY_MIN_BLOCK;
+  for (size_t i = 0; i < blocks; ++i)
+    buddy->tags[i] = 0;
+
+  // Cover the region with the biggest blocks whose address is
+  // aligned to their size, so that aligned allocations need no padding
+  size_t offset = 0;
+  while (offset < buddy->size)
+  {
+    size_t order = MICRO_ARENA_BUDDY_ORDERS - 1;
+    while ((uintptr_t)(base + offset)
+           % ((size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << order) != 0
+           || offset + ((size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << order)
+              > buddy->size)
+      order--;
+    micro_arena_buddy_push(buddy, order, offset);
+    offset += (size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << order;
+  }
+  return true;
+}
+
+MICRO_ARENA_DEF void *micro_arena_buddy_malloc(MicroArenaBuddy *buddy,
+                                               size_t size)
+{
+  if (!buddy)
+    return NULL;
+
+  size_t order = 0;
+  while (((size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << order) < size)
+    if (++order >= MICRO_ARENA_BUDDY_ORDERS)
+      return NULL;
+
+  size_t k = order;
+  while (k < MICRO_ARENA_BUDDY_ORDERS && !buddy->free_lists[k])
+    k++;
+  if (k >= MICRO_ARENA_BUDDY_ORDERS)
+    return NULL;
+
+  size_t offset = (size_t)((char*)buddy->free_lists[k] - buddy->base);
+  micro_arena_buddy_unlink(buddy, k, offset);
+
+  // Split, keeping the lower half and freeing the upper one
+  while (k > order)
+  {
+    k--;
+    micro_arena_buddy_push(buddy, k,
+                           offset + ((size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << k));
+  }
+
+  buddy->tags[offset / MICRO_ARENA_BUDDY_MIN_BLOCK] = (unsigned char)(order + 1);
+  return buddy->base + offset;
+}
+
+MICRO_ARENA_DEF void micro_arena_buddy_free(MicroArenaBuddy *buddy,
+                                            void *ptr)
+{
+  size_t size = micro_arena_buddy_block_size(buddy, ptr);
+  if (size == 0)
+    return;
+
+  size_t offset = (size_t)((char*)ptr - buddy->base);
+  size_t order = buddy->tags[offset / MICRO_ARENA_BUDDY_MIN_BLOCK] - 1u;
+  buddy->tags[offset / MICRO_ARENA_BUDDY_MIN_BLOCK] = 0;
+
+  // Merge with the buddy while it is a free block of the same order
+  while (order + 1 < MICRO_ARENA_BUDDY_ORDERS)
+  {
+    size_t block_size = (size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << order;
+    uintptr_t buddy_address = ((uintptr_t)buddy->base + offset) ^ block_size;
+    if (buddy_address < (uintptr_t)buddy->base)
+      break;
+    size_t buddy_offset = (size_t)(buddy_address - (uintptr_t)buddy->base);
+    if (buddy_offset + block_size > buddy->size
+        || buddy->tags[buddy_offset / MICRO_ARENA_BUDDY_MIN_BLOCK]
+           != ((order + 1) | MICRO_ARENA_BUDDY_FREE))
+      break;
+
+    micro_arena_buddy_unlink(buddy, order, buddy_offset);
+    if (buddy_offset < offset)
+      offset = buddy_offset;
+    order++;
+  }
+
+  micro_arena_buddy_push(buddy, order, offset);
+  return;
+}
+
+MICRO_ARENA_DEF size_t micro_arena_buddy_block_size(MicroArenaBuddy *buddy,
+                                                    void *ptr)
+{
+  if (!buddy || (char*)ptr < buddy->base
+      || (char*)ptr >= buddy->base + buddy->size)
+    return 0;
+
+  size_t offset = (size_t)((char*)ptr - buddy->base);
+  if (offset % MICRO_ARENA_BUDDY_MIN_BLOCK != 0)
+    return 0;
+
+  unsigned char tag = buddy->tags[offset / MICRO_ARENA_BUDDY_MIN_BLOCK];
+  if (tag == 0 || (tag & MICRO_ARENA_BUDDY_FREE))
+    return 0;
+  return (size_t)MICRO_ARENA_BUDDY_MIN_BLOCK << (tag - 1);
+}
+
+// A slab starts with a header, aligned like the slots, which
+// links the slabs and remembers where the arena allocation starts
+typedef struct {
+  void *next;
+  void *allocation;
+} MicroArenaPoolSlab;
+
+#define MICRO_ARENA_POOL_SLAB_HEADER_SIZE                               \
+  ((sizeof(MicroArenaPoolSlab) + MICRO_ARENA_POOL_ALIGNMENT - 1)        \
+   / MICRO_ARENA_POOL_ALIGNMENT * MICRO_ARENA_POOL_ALIGNMENT)
+
+MICRO_ARENA_DEF bool micro_arena_pool_init(MicroArenaPool *pool,
+                                           MicroArena *ma,
+                                           size_t slot_size,
+                                           size_t slots_per_slab,
+                                           bool grow)
+{
+  if (!pool || !ma || slots_per_slab == 0)
+    return false;
+
+  if (slot_size < sizeof(void*))
+    slot_size = sizeof(void*);
+  slot_size = (slot_size + MICRO_ARENA_POOL_ALIGNMENT - 1)
+    / MICRO_ARENA_POOL_ALIGNMENT * MICRO_ARENA_POOL_ALIGNMENT;
+
+  pool->arena = ma;
+  pool->slot_size = slot_size;
+  pool->slots_per_slab = slots_per_slab;
+  pool->grow = grow;
+  pool->free_list = NULL;
+  pool->slabs = NULL;
+  pool->bump = NULL;
+  pool->bump_end = NULL;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_init(&pool->pool_mutex, NULL);
+  #endif
+
+  return micro_arena_pool_add_slab(pool);
+}
+
+MICRO_ARENA_DEF bool micro_arena_pool_add_slab(MicroArenaPool *pool)
+{
+  if (!pool)
+    return false;
+
+  size_t slots_size = pool->slot_size * pool->slots_per_slab;
+  if (slots_size / pool->slot_size != pool->slots_per_slab)
+    return false;
+  size_t size = MICRO_ARENA_POOL_ALIGNMENT - 1
+    + MICRO_ARENA_POOL_SLAB_HEADER_SIZE + slots_size;
+  if (size < slots_size)
+    return false;
+
+  char *allocation = (char*)micro_arena_malloc(pool->arena, size);
+  if (!allocation)
+    return false;
+
+  uintptr_t misalignment =
+    (uintptr_t)allocation % MICRO_ARENA_POOL_ALIGNMENT;
+  char *header = allocation;
+  if (misalignment)
+    header += MICRO_ARENA_POOL_ALIGNMENT - misalignment;
+
+  MicroArenaPoolSlab *slab = (MicroArenaPoolSlab*)header;
+  slab->next = pool->slabs;
+  slab->allocation = allocation;
+  pool->slabs = slab;
+  pool->bump = header + MICRO_ARENA_POOL_SLAB_HEADER_SIZE;
+  pool->bump_end = pool->bump + slots_size;
+  return true;
+}
+
+MICRO_ARENA_DEF void *micro_arena_pool_alloc(MicroArenaPool *pool)
+{
+  if (!pool)
+    return NULL;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&pool->pool_mutex);
+  #endif
+
+  void *slot = NULL;
+  if (pool->free_list)
+  {
+    slot = pool->free_list;
+    pool->free_list = *(void**)slot;
+    goto exit;
+  }
+
+  if (pool->bump == pool->bump_end
+      && (!pool->grow || !micro_arena_pool_add_slab(pool)))
+    goto exit;
+
+  slot = pool->bump;
+  pool->bump += pool->slot_size;
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&pool->pool_mutex);
+  #endif
+  return slot;
+}
+
+MICRO_ARENA_DEF void micro_arena_pool_free(MicroArenaPool *pool, void *ptr)
+{
+  if (!pool || !ptr)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&pool->pool_mutex);
+  #endif
+
+  *(void**)ptr = pool->free_list;
+  pool->free_list = ptr;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&pool->pool_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_pool_destroy(MicroArenaPool *pool)
+{
+  if (!pool)
+    return;
+
+  while (pool->slabs)
+  {
+    MicroArenaPoolSlab *slab = (MicroArenaPoolSlab*)pool->slabs;
+    pool->slabs = slab->next;
+    micro_arena_free(pool->arena, slab->allocation);
+  }
+  pool->free_list = NULL;
+  pool->bump = NULL;
+  pool->bump_end = NULL;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&pool->pool_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool
+micro_arena_size_classes_init(MicroArenaSizeClasses *classes,
+                              MicroArena *ma, size_t slots_per_slab)
+{
+  if (!classes || !ma || slots_per_slab == 0)
+    return false;
+
+  for (size_t i = 0; i < MICRO_ARENA_SIZE_CLASSES; ++i)
+  {
+    // Like micro_arena_pool_init, without carving the first slab
+    MicroArenaPool *pool = &classes->pools[i];
+    pool->arena = ma;
+    pool->slot_size = (size_t)MICRO_ARENA_POOL_ALIGNMENT << i;
+    pool->slots_per_slab = slots_per_slab;
+    pool->grow = true;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->bump = NULL;
+    pool->bump_end = NULL;
+    #ifdef MICRO_ARENA_MULTITHREADED
+    pthread_mutex_init(&pool->pool_mutex, NULL);
+    #endif
+  }
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+  ma->size_classes = classes;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF void
+micro_arena_size_classes_destroy(MicroArenaSizeClasses *classes)
+{
+  if (!classes)
+    return;
+
+  MicroArena *ma = classes->pools[0].arena;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ma->arena_mutex);
+  #endif
+  if (ma->size_classes == classes)
+    ma->size_classes = NULL;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ma->arena_mutex);
+  #endif
+
+  for (size_t i = 0; i < MICRO_ARENA_SIZE_CLASSES; ++i)
+    micro_arena_pool_destroy(&classes->pools[i]);
+  return;
+}
+
+MICRO_ARENA_DEF void *micro_arena_class_malloc(MicroArena *ma,
+                                               size_t size_class,
+                                               size_t size)
+{
+  if (!ma)
+    return NULL;
+  if (size_class < MICRO_ARENA_SIZE_CLASSES && ma->size_classes)
+    return micro_arena_pool_alloc(&ma->size_classes->pools[size_class]);
+  return micro_arena_aligned_alloc(ma, MICRO_ARENA_POOL_ALIGNMENT, size);
+}
+
+MICRO_ARENA_DEF void micro_arena_class_free(MicroArena *ma,
+                                            size_t size_class, void *ptr)
+{
+  if (!ma)
+    return;
+  if (size_class < MICRO_ARENA_SIZE_CLASSES && ma->size_classes)
+  {
+    micro_arena_pool_free(&ma->size_classes->pools[size_class], ptr);
+    return;
+  }
+  micro_arena_free(ma, ptr);
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_bitmap_init(MicroArenaBitmap *bitmap,
+                                             MicroArena *ma,
+                                             size_t block_size,
+                                             size_t num_blocks)
+{
+  if (!bitmap || !ma || block_size == 0 || num_blocks == 0)
+    return false;
+
+  size_t alignment = 16;
+  while (alignment > 1 && block_size % alignment != 0)
+    alignment /= 2;
+  if (alignment < sizeof(uint64_t))
+    alignment = sizeof(uint64_t);
+
+  size_t num_words = (num_blocks + 63) / 64;
+  size_t blocks_size = block_size * num_blocks;
+  if (blocks_size / block_size != num_blocks)
+    return false;
+  // Worst case padding before the words and before the blocks
+  size_t size = 2 * alignment + num_words * sizeof(uint64_t) + blocks_size;
+  if (size < blocks_size)
+    return false;
+
+  char *allocation = (char*)micro_arena_malloc(ma, size);
+  if (!allocation)
+    return false;
+
+  uintptr_t words = ((uintptr_t)allocation + alignment - 1)
+    / alignment * alignment;
+  uintptr_t blocks = (words + num_words * sizeof(uint64_t) + alignment - 1)
+    / alignment * alignment;
+
+  bitmap->arena = ma;
+  bitmap->allocation = allocation;
+  bitmap->block_size = block_size;
+  bitmap->num_blocks = num_blocks;
+  bitmap->num_words = num_words;
+  bitmap->words = (uint64_t*)(allocation + (words - (uintptr_t)allocation));
+  bitmap->blocks = allocation + (blocks - (uintptr_t)allocation);
+  bitmap->hint = 0;
+
+  for (size_t w = 0; w < num_words; ++w)
+    bitmap->words[w] = 0;
+  // The bits past the last block are never handed out
+  if (num_blocks % 64 != 0)
+    bitmap->words[num_words - 1] = ~(uint64_t)0 << (num_blocks % 64);
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_init(&bitmap->bitmap_mutex, NULL);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF void *micro_arena_bitmap_alloc(MicroArenaBitmap *bitmap)
+{
+  if (!bitmap)
+    return NULL;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&bitmap->bitmap_mutex);
+  #endif
+
+  void *block = NULL;
+  for (size_t w = bitmap->hint; w < bitmap->num_words; ++w)
+  {
+    uint64_t free_bits = ~bitmap->words[w];
+    if (free_bits == 0)
+      continue;
+
+    #if defined(__GNUC__)
+    size_t bit = (size_t)__builtin_ctzll(free_bits);
+    #else
+    size_t bit = 0;
+    while (!(free_bits & ((uint64_t)1 << bit)))
+      bit++;
+    #endif
+
+    bitmap->words[w] |= (uint64_t)1 << bit;
+    bitmap->hint = w;
+    block = bitmap->blocks + (64 * w + bit) * bitmap->block_size;
+    break;
+  }
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&bitmap->bitmap_mutex);
+  #endif
+  return block;
+}
+
+MICRO_ARENA_DEF void micro_arena_bitmap_free(MicroArenaBitmap *bitmap,
+                                             void *ptr)
+{
+  if (!micro_arena_bitmap_owns(bitmap, ptr))
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&bitmap->bitmap_mutex);
+  #endif
+
+  size_t offset = (size_t)((char*)ptr - bitmap->blocks);
+  size_t index = offset / bitmap->block_size;
+  uint64_t bit = (uint64_t)1 << (index % 64);
+  // Inside a block, or a block already freed
+  if (offset % bitmap->block_size != 0 || !(bitmap->words[index / 64] & bit))
+    goto exit;
+  bitmap->words[index / 64] &= ~bit;
+  if (index / 64 < bitmap->hint)
+    bitmap->hint = index / 64;
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&bitmap->bitmap_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_bitmap_owns(MicroArenaBitmap *bitmap,
+                                             void *ptr)
+{
+  if (!bitmap || !bitmap->blocks)
+    return false;
+  return (char*)ptr >= bitmap->blocks
+    && (char*)ptr < bitmap->blocks + bitmap->block_size * bitmap->num_blocks;
+}
+
+MICRO_ARENA_DEF void micro_arena_bitmap_destroy(MicroArenaBitmap *bitmap)
+{
+  if (!bitmap || !bitmap->allocation)
+    return;
+
+  micro_arena_free(bitmap->arena, bitmap->allocation);
+  bitmap->allocation = NULL;
+  bitmap->words = NULL;
+  bitmap->blocks = NULL;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&bitmap->bitmap_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_stack_init(MicroArenaStack *stack,
+                                            MicroArena *ma, size_t size)
+{
+  if (!stack || !ma || size > SIZE_MAX - MICRO_ARENA_STACK_ALIGNMENT)
+    return false;
+
+  char *allocation =
+    (char*)micro_arena_malloc(ma, size + MICRO_ARENA_STACK_ALIGNMENT - 1);
+  if (!allocation)
+    return false;
+
+  uintptr_t misalignment =
+    (uintptr_t)allocation % MICRO_ARENA_STACK_ALIGNMENT;
+  stack->arena = ma;
+  stack->allocation = allocation;
+  stack->base = allocation;
+  if (misalignment)
+    stack->base += MICRO_ARENA_STACK_ALIGNMENT - misalignment;
+  stack->size = size;
+  stack->top = 0;
+  stack->last = MICRO_ARENA_STACK_EMPTY;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_init(&stack->stack_mutex, NULL);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF void *micro_arena_stack_alloc(MicroArenaStack *stack,
+                                              size_t size)
+{
+  if (!stack || !stack->base)
+    return NULL;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&stack->stack_mutex);
+  #endif
+
+  void *block = NULL;
+  MicroArenaStackHeader *h;
+  size_t header = (stack->top + MICRO_ARENA_STACK_ALIGNMENT - 1)
+    / MICRO_ARENA_STACK_ALIGNMENT * MICRO_ARENA_STACK_ALIGNMENT;
+  if (header > stack->size
+      || stack->size - header < sizeof(MicroArenaStackHeader)
+      || stack->size - header - sizeof(MicroArenaStackHeader) < size)
+    goto exit;
+
+  h = (MicroArenaStackHeader*)(stack->base + header);
+  h->prev = stack->last;
+  h->freed = 0;
+  stack->last = header;
+  stack->top = header + sizeof(MicroArenaStackHeader) + size;
+  block = h + 1;
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&stack->stack_mutex);
+  #endif
+  return block;
+}
+
+MICRO_ARENA_DEF void micro_arena_stack_free(MicroArenaStack *stack,
+                                            void *ptr)
+{
+  if (!stack || !stack->base || (char*)ptr < stack->base
+      + sizeof(MicroArenaStackHeader)
+      || (char*)ptr > stack->base + stack->top)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&stack->stack_mutex);
+  #endif
+
+  // Only a header on the chain from the top block is trusted
+  MicroArenaStackHeader *h;
+  size_t header = (size_t)((char*)ptr - stack->base)
+    - sizeof(MicroArenaStackHeader);
+  size_t offset = stack->last;
+  while (offset != MICRO_ARENA_STACK_EMPTY && offset > header)
+    offset = ((MicroArenaStackHeader*)(stack->base + offset))->prev;
+  if (offset != header)
+    goto exit;
+  h = (MicroArenaStackHeader*)(stack->base + header);
+  if (h->freed)
+    goto exit;
+  h->freed = 1;
+
+  while (stack->last != MICRO_ARENA_STACK_EMPTY)
+  {
+    h = (MicroArenaStackHeader*)(stack->base + stack->last);
+    if (!h->freed)
+      break;
+    stack->top = stack->last;
+    stack->last = h->prev;
+  }
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&stack->stack_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_stack_reset(MicroArenaStack *stack)
+{
+  if (!stack)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&stack->stack_mutex);
+  #endif
+  stack->top = 0;
+  stack->last = MICRO_ARENA_STACK_EMPTY;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&stack->stack_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_stack_destroy(MicroArenaStack *stack)
+{
+  if (!stack || !stack->allocation)
+    return;
+
+  micro_arena_free(stack->arena, stack->allocation);
+  stack->allocation = NULL;
+  stack->base = NULL;
+  stack->size = 0;
+  stack->top = 0;
+  stack->last = MICRO_ARENA_STACK_EMPTY;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&stack->stack_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_ring_init(MicroArenaRing *ring,
+                                           MicroArena *ma, size_t size)
+{
+  size = size / MICRO_ARENA_RING_ALIGNMENT * MICRO_ARENA_RING_ALIGNMENT;
+  if (!ring || !ma || size == 0)
+    return false;
+
+  char *allocation =
+    (char*)micro_arena_malloc(ma, size + MICRO_ARENA_RING_ALIGNMENT - 1);
+  if (!allocation)
+    return false;
+
+  uintptr_t misalignment =
+    (uintptr_t)allocation % MICRO_ARENA_RING_ALIGNMENT;
+  ring->arena = ma;
+  ring->allocation = allocation;
+  ring->base = allocation;
+  if (misalignment)
+    ring->base += MICRO_ARENA_RING_ALIGNMENT - misalignment;
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->used = 0;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_init(&ring->ring_mutex, NULL);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF void *micro_arena_ring_alloc(MicroArenaRing *ring,
+                                             size_t size)
+{
+  if (!ring || !ring->base
+      || size > ring->size - sizeof(MicroArenaRingHeader))
+    return NULL;
+
+  size_t span = (sizeof(MicroArenaRingHeader) + size
+                 + MICRO_ARENA_RING_ALIGNMENT - 1)
+    / MICRO_ARENA_RING_ALIGNMENT * MICRO_ARENA_RING_ALIGNMENT;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ring->ring_mutex);
+  #endif
+
+  void *block = NULL;
+  MicroArenaRingHeader *h;
+  if (ring->head > ring->tail || ring->used == 0)
+  {
+    // Free space is [head, size) and [0, tail)
+    if (ring->size - ring->head < span)
+    {
+      if (ring->tail < span)
+        goto exit;
+      // Skip the remainder, it is released with the block before it
+      h = (MicroArenaRingHeader*)(ring->base + ring->head);
+      h->span = ring->size - ring->head;
+      h->freed = 1;
+      ring->used += h->span;
+      ring->head = 0;
+    }
+  }
+  else if (ring->tail - ring->head < span)
+  {
+    // Free space is [head, tail)
+    goto exit;
+  }
+
+  h = (MicroArenaRingHeader*)(ring->base + ring->head);
+  h->span = span;
+  h->freed = 0;
+  ring->used += span;
+  ring->head += span;
+  if (ring->head == ring->size)
+    ring->head = 0;
+  block = h + 1;
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ring->ring_mutex);
+  #endif
+  return block;
+}
+
+MICRO_ARENA_DEF void micro_arena_ring_free(MicroArenaRing *ring,
+                                           void *ptr)
+{
+  if (!ring || !ring->base
+      || (char*)ptr < ring->base + sizeof(MicroArenaRingHeader)
+      || (char*)ptr >= ring->base + ring->size)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ring->ring_mutex);
+  #endif
+
+  // Only a header reached by walking the blocks from tail is trusted
+  MicroArenaRingHeader *h;
+  size_t header = (size_t)((char*)ptr - ring->base)
+    - sizeof(MicroArenaRingHeader);
+  size_t offset = ring->tail, walked = 0;
+  while (walked < ring->used && offset != header)
+  {
+    walked += ((MicroArenaRingHeader*)(ring->base + offset))->span;
+    offset += ((MicroArenaRingHeader*)(ring->base + offset))->span;
+    if (offset == ring->size)
+      offset = 0;
+  }
+  if (walked >= ring->used)
+    goto exit;
+  h = (MicroArenaRingHeader*)(ring->base + header);
+  if (h->freed)
+    goto exit;
+  h->freed = 1;
+
+  while (ring->used > 0)
+  {
+    h = (MicroArenaRingHeader*)(ring->base + ring->tail);
+    if (!h->freed)
+      break;
+    ring->used -= h->span;
+    ring->tail += h->span;
+    if (ring->tail == ring->size)
+      ring->tail = 0;
+  }
+  // Start again from the beginning for better locality
+  if (ring->used == 0)
+  {
+    ring->head = 0;
+    ring->tail = 0;
+  }
+
+ exit:
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ring->ring_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_ring_reset(MicroArenaRing *ring)
+{
+  if (!ring)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&ring->ring_mutex);
+  #endif
+  ring->head = 0;
+  ring->tail = 0;
+  ring->used = 0;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&ring->ring_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void micro_arena_ring_destroy(MicroArenaRing *ring)
+{
+  if (!ring || !ring->allocation)
+    return;
+
+  micro_arena_free(ring->arena, ring->allocation);
+  ring->allocation = NULL;
+  ring->base = NULL;
+  ring->size = 0;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->used = 0;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&ring->ring_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_frame_init(MicroArenaFrame *frame,
+                                            MicroArena *ma,
+                                            size_t region_size,
+                                            size_t num_regions)
+{
+  if (!frame || !ma || region_size == 0 || num_regions == 0
+      || region_size > SIZE_MAX - MICRO_ARENA_FRAME_ALIGNMENT)
+    return false;
+
+  region_size = (region_size + MICRO_ARENA_FRAME_ALIGNMENT - 1)
+    / MICRO_ARENA_FRAME_ALIGNMENT * MICRO_ARENA_FRAME_ALIGNMENT;
+  if (region_size > (SIZE_MAX - MICRO_ARENA_FRAME_ALIGNMENT) / num_regions)
+    return false;
+
+  char *allocation =
+    (char*)micro_arena_malloc(ma, region_size * num_regions
+                              + MICRO_ARENA_FRAME_ALIGNMENT - 1);
+  if (!allocation)
+    return false;
+
+  uintptr_t misalignment =
+    (uintptr_t)allocation % MICRO_ARENA_FRAME_ALIGNMENT;
+  frame->arena = ma;
+  frame->allocation = allocation;
+  frame->base = allocation;
+  if (misalignment)
+    frame->base += MICRO_ARENA_FRAME_ALIGNMENT - misalignment;
+  frame->region_size = region_size;
+  frame->num_regions = num_regions;
+  frame->current = 0;
+  frame->top = 0;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_init(&frame->frame_mutex, NULL);
+  #endif
+  return true;
+}
+
+MICRO_ARENA_DEF void micro_arena_frame_begin(MicroArenaFrame *frame)
+{
+  if (!frame || !frame->base)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&frame->frame_mutex);
+  #endif
+  frame->current = (frame->current + 1) % frame->num_regions;
+  frame->top = 0;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&frame->frame_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF void *micro_arena_frame_alloc(MicroArenaFrame *frame,
+                                              size_t size)
+{
+  if (!frame || !frame->base)
+    return NULL;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&frame->frame_mutex);
+  #endif
+
+  void *ptr = NULL;
+  if (size <= frame->region_size - frame->top)
+  {
+    ptr = frame->base + frame->current * frame->region_size + frame->top;
+    // Does not overflow, region_size is a multiple of the alignment
+    size_t end = frame->top + size;
+    frame->top = end + (MICRO_ARENA_FRAME_ALIGNMENT
+                        - end % MICRO_ARENA_FRAME_ALIGNMENT)
+      % MICRO_ARENA_FRAME_ALIGNMENT;
+  }
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&frame->frame_mutex);
+  #endif
+  return ptr;
+}
+
+MICRO_ARENA_DEF void micro_arena_frame_destroy(MicroArenaFrame *frame)
+{
+  if (!frame || !frame->allocation)
+    return;
+
+  micro_arena_free(frame->arena, frame->allocation);
+  frame->allocation = NULL;
+  frame->base = NULL;
+  frame->region_size = 0;
+  frame->num_regions = 0;
+  frame->current = 0;
+  frame->top = 0;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&frame->frame_mutex);
+  #endif
+  return;
+}
+
+MICRO_ARENA_DEF bool micro_arena_cache_init(MicroArenaCache *cache,
+                                            MicroArenaInline *arenas,
+                                            size_t num_arenas)
+{
+  if (!cache || !arenas || num_arenas == 0
+      || num_arenas > MICRO_ARENA_CACHE_MAX_ARENAS)
+    return false;
+
+  cache->arenas = arenas;
+  cache->num_arenas = num_arenas;
+  cache->num_idle = 0;
+  cache->retain = SIZE_MAX;
+  // Hand out the first arena first
+  for (size_t i = num_arenas; i > 0; --i)
+  {
+    micro_arena_init(&arenas[i - 1]);
+    cache->idle[cache->num_idle++] = &arenas[i - 1].arena;
+  }
 
- exit:
   #ifdef MICRO_ARENA_MULTITHREADED
-  pthread_mutex_unlock(&ma->arena_mutex);
+  pthread_mutex_init(&cache->cache_mutex, NULL);
   #endif
-  return;
+  return true;
 }
 
-MICRO_ARENA_DEF void *micro_arena_calloc(MicroArena *ma, size_t nmemb, size_t size)
+MICRO_ARENA_DEF MicroArena *micro_arena_cache_acquire(MicroArenaCache *cache)
 {
-  if (!ma)
+  if (!cache)
     return NULL;
 
-  char* mem = micro_arena_malloc(ma, size * nmemb);
-  if (!mem)
-    return NULL;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&cache->cache_mutex);
+  #endif
 
-  for (size_t i = 0; i < nmemb * size; ++i)
-    mem[i] = 0;
+  MicroArena *ma = NULL;
+  if (cache->num_idle > 0)
+    ma = cache->idle[--cache->num_idle];
 
-  return mem;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&cache->cache_mutex);
+  #endif
+  return ma;
 }
 
-MICRO_ARENA_DEF void *micro_arena_realloc(MicroArena *ma, void *ptr, size_t size)
+MICRO_ARENA_DEF void micro_arena_cache_release(MicroArenaCache *cache,
+                                               MicroArena *ma)
 {
-  if (!ma)
-    return NULL;
+  if (!cache || !cache->arenas)
+    return;
+  // The arena is the first member of each MicroArenaInline
+  uintptr_t offset = (uintptr_t)ma - (uintptr_t)cache->arenas;
+  if (offset % sizeof(MicroArenaInline) != 0
+      || offset / sizeof(MicroArenaInline) >= cache->num_arenas)
+    return;
 
-  if (ptr == NULL)
-    return micro_arena_malloc(ma, size);
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&cache->cache_mutex);
+  #endif
+  size_t retain = cache->retain;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&cache->cache_mutex);
+  #endif
 
-  MicroArenaChunk *used_chunk =
-    micro_arena_chunk_list_get(&ma->used_chunks, ptr);
-  if (!used_chunk)
-    return NULL;
-  
-  char* mem = micro_arena_malloc(ma, size);
-  if (!mem)
-    return NULL;
+  micro_arena_reset_retain(ma, retain);
 
-  size_t min_size = (used_chunk->size < size) ? used_chunk->size : size;
-  for (size_t i = 0; i < min_size; ++i)
-    mem[i] = ((char*)ptr)[i];
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&cache->cache_mutex);
+  #endif
+  if (cache->num_idle < cache->num_arenas)
+    cache->idle[cache->num_idle++] = ma;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&cache->cache_mutex);
+  #endif
+  return;
+}
 
-  micro_arena_free(ma, ptr);
-  return mem;
+MICRO_ARENA_DEF void micro_arena_cache_set_retain(MicroArenaCache *cache,
+                                                  size_t bytes)
+{
+  if (!cache)
+    return;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_lock(&cache->cache_mutex);
+  #endif
+  cache->retain = bytes;
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_unlock(&cache->cache_mutex);
+  #endif
+  return;
 }
 
-MICRO_ARENA_DEF void *micro_arena_reallocarray(MicroArena *ma, void *ptr,
-                                               size_t nmemb, size_t size)
+MICRO_ARENA_DEF void micro_arena_cache_destroy(MicroArenaCache *cache)
 {
-  return micro_arena_realloc(ma, ptr, nmemb * size);
+  if (!cache || !cache->arenas)
+    return;
+
+  cache->arenas = NULL;
+  cache->num_arenas = 0;
+  cache->num_idle = 0;
+
+  #ifdef MICRO_ARENA_MULTITHREADED
+  pthread_mutex_destroy(&cache->cache_mutex);
+  #endif
+  return;
 }
 
-MICRO_ARENA_DEF MicroArenaChunk*
+MICRO_ARENA_DEF bool
 micro_arena_chunk_list_add(MicroArenaChunkList *chunk_list,
-                           void* start, size_t size)
+                           size_t offset, size_t size)
 {
-  if (!chunk_list || chunk_list->len + 1 >= MICRO_ARENA_MAX_NUM_CHUNKS)
+  if (!chunk_list || chunk_list->len >= chunk_list->cap
+      || offset > MICRO_ARENA_SIZE_MAX || size > MICRO_ARENA_SIZE_MAX)
   {
-    return NULL;
+    return false;
   }
 
-  chunk_list->chunks[chunk_list->len] = (MicroArenaChunk){
-    .start = start,
-    .size = size,
-  };
+  chunk_list->offsets[chunk_list->len] = (MicroArenaSize)offset;
+  chunk_list->sizes[chunk_list->len] = (MicroArenaSize)size;
   chunk_list->len++;
-  return &chunk_list->chunks[chunk_list->len - 1];
+  return true;
 }
 
 MICRO_ARENA_DEF void
 micro_arena_chunk_list_remove(MicroArenaChunkList *chunk_list,
-                              void* start)
+                              size_t offset)
 {
-  if (!chunk_list)
-    return;
-  
-  size_t i = 0;
-  while (i < chunk_list->len)
-  {
-    if (chunk_list->chunks[i].start == start)
-      break;
-    ++i;
-  }
-  if (i >= chunk_list->len)
+  micro_arena_chunk_list_remove_at(chunk_list,
+                                   micro_arena_chunk_list_get(chunk_list,
+                                                              offset));
+  return;
+}
+
+MICRO_ARENA_DEF void
+micro_arena_chunk_list_remove_at(MicroArenaChunkList *chunk_list,
+                                 size_t index)
+{
+  if (!chunk_list || index >= chunk_list->len)
     return;
   
-  for (i = i+1; i < chunk_list->len; ++i)
+  for (size_t i = index + 1; i < chunk_list->len; ++i)
   {
-    chunk_list->chunks[i-1] = chunk_list->chunks[i];
+    chunk_list->offsets[i-1] = chunk_list->offsets[i];
+    chunk_list->sizes[i-1] = chunk_list->sizes[i];
   }
   chunk_list->len--;
   return;
 }
 
-MICRO_ARENA_DEF MicroArenaChunk*
+MICRO_ARENA_DEF size_t
 micro_arena_chunk_list_get(MicroArenaChunkList *chunk_list,
-                           void* start)
+                           size_t offset)
 {
   if (!chunk_list)
-    return NULL;
+    return 0;
   
   for (size_t i = 0; i < chunk_list->len; ++i)
-    if (chunk_list->chunks[i].start == start)
-      return &chunk_list->chunks[i];
+    if (chunk_list->offsets[i] == offset)
+      return i;
 
-  return NULL;
+  return chunk_list->len;
+}
+
+MICRO_ARENA_DEF size_t
+micro_arena_chunk_list_find_fit(MicroArenaChunkList *chunk_list,
+                                size_t size, size_t from)
+{
+  if (!chunk_list)
+    return 0;
+
+  if (size > MICRO_ARENA_SIZE_MAX)
+    return chunk_list->len;
+
+  size_t i = from;
+
+  // The masks have one bit per byte: a lane that fits sets
+  // sizeof(MicroArenaSize) bits. There are no unsigned compares,
+  // 8, 16 and 32 bit lanes fit if max(lane, size) == lane and 64 bit
+  // lanes are compared as signed after flipping their sign bit.
+  #if defined(MICRO_ARENA_SIMD_AVX2)
+  const size_t lanes = 32 / sizeof(MicroArenaSize);
+  #if defined(MICRO_ARENA_COMPACT_16)
+  const __m256i wanted = _mm256_set1_epi16((short)size);
+  #elif defined(MICRO_ARENA_COMPACT)
+  const __m256i wanted = _mm256_set1_epi32((int)size);
+  #else
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i wanted =
+    _mm256_xor_si256(_mm256_set1_epi64x((long long)size), sign);
+  #endif
+  for (; i + lanes <= chunk_list->len; i += lanes)
+  {
+    __m256i sizes =
+      _mm256_loadu_si256((const __m256i*)&chunk_list->sizes[i]);
+    #if defined(MICRO_ARENA_COMPACT_16)
+    __m256i fits =
+      _mm256_cmpeq_epi16(_mm256_max_epu16(sizes, wanted), sizes);
+    #elif defined(MICRO_ARENA_COMPACT)
+    __m256i fits =
+      _mm256_cmpeq_epi32(_mm256_max_epu32(sizes, wanted), sizes);
+    #else
+    __m256i fits =
+      _mm256_andnot_si256(_mm256_cmpgt_epi64(wanted,
+                                             _mm256_xor_si256(sizes, sign)),
+                          _mm256_set1_epi8(-1));
+    #endif
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(fits);
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask) / sizeof(MicroArenaSize);
+  }
+  #elif defined(MICRO_ARENA_SIMD_SSE42)
+  const size_t lanes = 16 / sizeof(MicroArenaSize);
+  #if defined(MICRO_ARENA_COMPACT_16)
+  const __m128i wanted = _mm_set1_epi16((short)size);
+  #elif defined(MICRO_ARENA_COMPACT)
+  const __m128i wanted = _mm_set1_epi32((int)size);
+  #else
+  const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+  const __m128i wanted =
+    _mm_xor_si128(_mm_set1_epi64x((long long)size), sign);
+  #endif
+  for (; i + lanes <= chunk_list->len; i += lanes)
+  {
+    __m128i sizes =
+      _mm_loadu_si128((const __m128i*)&chunk_list->sizes[i]);
+    #if defined(MICRO_ARENA_COMPACT_16)
+    __m128i fits = _mm_cmpeq_epi16(_mm_max_epu16(sizes, wanted), sizes);
+    #elif defined(MICRO_ARENA_COMPACT)
+    __m128i fits = _mm_cmpeq_epi32(_mm_max_epu32(sizes, wanted), sizes);
+    #else
+    __m128i fits =
+      _mm_andnot_si128(_mm_cmpgt_epi64(wanted, _mm_xor_si128(sizes, sign)),
+                       _mm_set1_epi8(-1));
+    #endif
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(fits);
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask) / sizeof(MicroArenaSize);
+  }
+  #endif
+
+  for (; i < chunk_list->len; ++i)
+    if (chunk_list->sizes[i] >= size)
+      return i;
+
+  return chunk_list->len;
+}
+
+MICRO_ARENA_DEF void
+micro_arena_chunk_list_init(MicroArenaChunkList *chunk_list,
+                            MicroArenaSize *offsets, MicroArenaSize *sizes,
+                            size_t cap)
+{
+  if (!chunk_list)
+    return;
+  chunk_list->offsets = offsets;
+  chunk_list->sizes = sizes;
+  chunk_list->len = 0;
+  chunk_list->cap = cap;
+  return;
 }
 
 MICRO_ARENA_DEF void
@@ -466,6 +3346,16 @@ micro_arena_debug_print(MicroArena *ma)
   printf("Used ");
   micro_arena_debug_print_chunk_list(&ma->used_chunks);
 
+  MicroArenaStats stats;
+  micro_arena_stats(ma, &stats);
+  printf("Free: %ld, used: %ld, largest free: %ld, fragmentation: %.3f\n",
+         stats.total_free, stats.total_used, stats.largest_free,
+         stats.fragmentation);
+
+  char map[65];
+  micro_arena_heap_map(ma, map, sizeof(map));
+  printf("Heap map: [%s]\n", map);
+
   printf("// ----------------------------------------------------------//\n");
   return;
 }
@@ -481,9 +3371,9 @@ micro_arena_debug_print_chunk_list(MicroArenaChunkList* chunk_list)
 
   printf("Chunk list len: %ld\n", chunk_list->len);
   for (size_t i = 0; i < chunk_list->len; ++i)
-    printf("- start = %p, size = %ld\n",
-           (void*)chunk_list->chunks[i].start,
-           chunk_list->chunks[i].size);
+    printf("- offset = %ld, size = %ld\n",
+           (size_t)chunk_list->offsets[i],
+           (size_t)chunk_list->sizes[i]);
 }
 
 #else
@@ -524,14 +3414,15 @@ MICRO_ARENA_DEF int micro_arena_version(void)
 
 int main(void)
 {
-  MicroArena ma;
-  micro_arena_init(&ma);
+  MicroArenaInline inl;
+  micro_arena_init(&inl);
+  MicroArena *ma = &inl.arena;
 
   int array_len = 10;
-  int* mem = micro_arena_malloc(&ma, sizeof(int) * array_len);
+  int* mem = micro_arena_malloc(ma, sizeof(int) * array_len);
   assert(mem != NULL);  
 
-  micro_arena_free(&ma, mem);
+  micro_arena_free(ma, mem);
   return 0;
 }
   
@@ -541,4 +3432,484 @@ int main(void)
 }
 #endif
 
+//
+// C++
+//
+
+#if defined(__cplusplus) && __cplusplus >= 201703L
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace micro_arena
+{
+
+// std::pmr::memory_resource over a MicroArena, which must outlive
+// it. Throws std::bad_alloc when the arena is full.
+class memory_resource : public std::pmr::memory_resource
+{
+public:
+  explicit memory_resource(MicroArena *ma) noexcept : ma_(ma) {}
+
+  MicroArena *arena() const noexcept { return ma_; }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    void *ptr = micro_arena_aligned_alloc(ma_, alignment, bytes);
+    if (!ptr)
+      throw std::bad_alloc();
+    return ptr;
+  }
+
+  void do_deallocate(void *ptr, std::size_t bytes, std::size_t) override
+  {
+    micro_arena_free_sized(ma_, ptr, bytes);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other)
+    const noexcept override
+  {
+    const memory_resource *o = dynamic_cast<const memory_resource*>(&other);
+    return o && o->ma_ == ma_;
+  }
+
+  MicroArena *ma_;
+};
+
+// Owns a MicroArena allocated on the heap, so that moving the arena
+// keeps the pointers into it valid. Movable, not copyable. The
+// destructor runs the cleanups and frees the segments.
+class arena
+{
+public:
+  arena() : inl_(new MicroArenaInline)
+  {
+    micro_arena_init(inl_);
+  }
+
+  // Grow by segments of at least segment_size bytes when full
+  explicit arena(std::size_t segment_size) : arena()
+  {
+    micro_arena_set_growth(get(), segment_size);
+  }
+
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+
+  arena(arena &&other) noexcept : inl_(other.inl_)
+  {
+    other.inl_ = nullptr;
+  }
+
+  arena &operator=(arena &&other) noexcept
+  {
+    if (this != &other)
+    {
+      release();
+      inl_ = other.inl_;
+      other.inl_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~arena()
+  {
+    release();
+  }
+
+  // nullptr once moved from
+  MicroArena *get() const noexcept { return inl_ ? &inl_->arena : nullptr; }
+
+  // Free every allocation, see micro_arena_reset
+  void reset() noexcept { micro_arena_reset(get()); }
+
+private:
+  void release() noexcept
+  {
+    if (!inl_)
+      return;
+    micro_arena_destroy(&inl_->arena);
+    delete inl_;
+    inl_ = nullptr;
+  }
+
+  MicroArenaInline *inl_;
+};
+
+// Arena with its memory and chunk tables inline, shaped by the
+// template arguments instead of MICRO_ARENA_STACK_MEM_SIZE and
+// MICRO_ARENA_MAX_NUM_CHUNKS, which can be set to 0 when every arena
+// is a basic_arena. Neither copyable nor movable, keep big ones in
+// static storage or on the heap.
+template <std::size_t Capacity, std::size_t MaxChunks,
+          MicroArenaPolicy Policy = MICRO_ARENA_DEFAULT_POLICY>
+class basic_arena
+{
+  static_assert(Capacity > 0 && Capacity <= MICRO_ARENA_SIZE_MAX,
+                "Capacity does not fit in a MicroArenaSize");
+  static_assert(MaxChunks > 0, "MaxChunks must not be 0");
+
+public:
+  static constexpr std::size_t capacity = Capacity;
+  static constexpr std::size_t max_chunks = MaxChunks;
+  static constexpr MicroArenaPolicy policy = Policy;
+
+  basic_arena() noexcept
+  {
+    micro_arena_init_chunks(get(), mem_, Capacity, chunks_, MaxChunks);
+    micro_arena_set_policy(get(), Policy);
+  }
+
+  basic_arena(const basic_arena &) = delete;
+  basic_arena &operator=(const basic_arena &) = delete;
+
+  ~basic_arena()
+  {
+    micro_arena_destroy(get());
+  }
+
+  MicroArena *get() noexcept { return &ma_; }
+
+  // Throws std::bad_alloc when full
+  void *allocate(std::size_t size,
+                 std::size_t alignment = alignof(std::max_align_t))
+  {
+    void *ptr = micro_arena_aligned_alloc(get(), alignment, size);
+    if (!ptr)
+      throw std::bad_alloc();
+    return ptr;
+  }
+
+  void deallocate(void *ptr) noexcept { micro_arena_free(get(), ptr); }
+
+  // Faster when size, the size given to allocate, is known
+  void deallocate(void *ptr, std::size_t size) noexcept
+  {
+    micro_arena_free_sized(get(), ptr, size);
+  }
+
+  // Free every allocation, see micro_arena_reset
+  void reset() noexcept { micro_arena_reset(get()); }
+
+private:
+  MicroArena ma_;
+  alignas(std::max_align_t) char mem_[Capacity];
+  MicroArenaSize chunks_[4 * MaxChunks];
+};
+
+// std::pmr::memory_resource with an N-byte arena inline, for small
+// short-lived containers on the stack. Allocations that do not fit
+// go to upstream, and deallocations are routed by address range.
+// Neither copyable nor movable, like basic_arena.
+template <std::size_t N, std::size_t MaxChunks = 16>
+class inline_arena : public std::pmr::memory_resource
+{
+public:
+  inline_arena() noexcept
+    : upstream_(std::pmr::get_default_resource()) {}
+
+  explicit inline_arena(std::pmr::memory_resource *upstream) noexcept
+    : upstream_(upstream) {}
+
+  MicroArena *get() noexcept { return arena_.get(); }
+  std::pmr::memory_resource *upstream() const noexcept { return upstream_; }
+
+  // Whether ptr is in the inline memory. O(1)
+  bool owns(const void *ptr) noexcept
+  {
+    return micro_arena_owns(arena_.get(), const_cast<void*>(ptr));
+  }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    void *ptr = micro_arena_aligned_alloc(arena_.get(), alignment, bytes);
+    if (ptr)
+      return ptr;
+    return upstream_->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *ptr, std::size_t bytes,
+                     std::size_t alignment) override
+  {
+    if (owns(ptr))
+      micro_arena_free_sized(arena_.get(), ptr, bytes);
+    else
+      upstream_->deallocate(ptr, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other)
+    const noexcept override
+  {
+    return this == &other;
+  }
+
+  basic_arena<N, MaxChunks> arena_;
+  std::pmr::memory_resource *upstream_;
+};
+
+// Size class of objects of size bytes, see MICRO_ARENA_SIZE_CLASS
+constexpr std::size_t size_class(std::size_t size) noexcept
+{
+  return MICRO_ARENA_SIZE_CLASS(size);
+}
+
+// Construct a T in ma, from the pool of its size class when ma has
+// size classes and T is not over-aligned. Throws std::bad_alloc when
+// the arena is full. Destroy it with destroy<T>, not through a base.
+template <typename T, typename... Args>
+T *make(MicroArena *ma, Args &&...args)
+{
+  void *ptr;
+  if constexpr (alignof(T) <= MICRO_ARENA_POOL_ALIGNMENT)
+    ptr = micro_arena_class_malloc(ma, size_class(sizeof(T)), sizeof(T));
+  else
+    ptr = micro_arena_aligned_alloc(ma, alignof(T), sizeof(T));
+  if (!ptr)
+    throw std::bad_alloc();
+
+  try
+  {
+    return ::new (ptr) T(std::forward<Args>(args)...);
+  }
+  catch (...)
+  {
+    if constexpr (alignof(T) <= MICRO_ARENA_POOL_ALIGNMENT)
+      micro_arena_class_free(ma, size_class(sizeof(T)), ptr);
+    else
+      micro_arena_free_sized(ma, ptr, sizeof(T));
+    throw;
+  }
+}
+
+template <typename T>
+void destroy(MicroArena *ma, T *ptr) noexcept
+{
+  if (!ptr)
+    return;
+  ptr->~T();
+  void *mem = const_cast<void*>(static_cast<const volatile void*>(ptr));
+  if constexpr (alignof(T) <= MICRO_ARENA_POOL_ALIGNMENT)
+    micro_arena_class_free(ma, size_class(sizeof(T)), mem);
+  else
+    micro_arena_free_sized(ma, mem, sizeof(T));
+}
+
+template <typename T, typename... Args>
+T *make(arena &a, Args &&...args)
+{
+  return make<T>(a.get(), std::forward<Args>(args)...);
+}
+
+template <typename T>
+void destroy(arena &a, T *ptr) noexcept
+{
+  destroy(a.get(), ptr);
+}
+
+template <typename T, std::size_t Capacity, std::size_t MaxChunks,
+          MicroArenaPolicy Policy, typename... Args>
+T *make(basic_arena<Capacity, MaxChunks, Policy> &a, Args &&...args)
+{
+  return make<T>(a.get(), std::forward<Args>(args)...);
+}
+
+template <typename T, std::size_t Capacity, std::size_t MaxChunks,
+          MicroArenaPolicy Policy>
+void destroy(basic_arena<Capacity, MaxChunks, Policy> &a, T *ptr) noexcept
+{
+  destroy(a.get(), ptr);
+}
+
+// Construct a T in ma that lives until ma is reset or destroyed,
+// which runs its destructor through the cleanup registry unless T
+// is trivially destructible. Never free or destroy it by hand.
+// Throws std::bad_alloc when the arena is full.
+template <typename T, typename... Args>
+T *create(MicroArena *ma, Args &&...args)
+{
+  T *ptr = make<T>(ma, std::forward<Args>(args)...);
+  if constexpr (!std::is_trivially_destructible_v<T>)
+  {
+    void (*fn)(void*) = [](void *obj) { static_cast<T*>(obj)->~T(); };
+    if (!micro_arena_register_cleanup(ma, fn, ptr))
+    {
+      destroy(ma, ptr);
+      throw std::bad_alloc();
+    }
+  }
+  return ptr;
+}
+
+// RAII arena owning the objects created in it, like protobuf arenas:
+// no destructor or free per object, the destructor and reset run the
+// non-trivial destructors newest first and release all the memory.
+class arena_owned : public arena
+{
+public:
+  using arena::arena;
+
+  template <typename T, typename... Args>
+  T *create(Args &&...args)
+  {
+    return micro_arena::create<T>(get(), std::forward<Args>(args)...);
+  }
+};
+
+// Arena of the coroutine frames created on this thread, nullptr for
+// the heap. Set it with coroutine_scope.
+inline MicroArena *&coroutine_arena() noexcept
+{
+  static thread_local MicroArena *ma = nullptr;
+  return ma;
+}
+
+// Points coroutine_arena at ma until the end of the scope
+class coroutine_scope
+{
+public:
+  explicit coroutine_scope(MicroArena *ma) noexcept
+    : previous_(coroutine_arena())
+  {
+    coroutine_arena() = ma;
+  }
+
+  explicit coroutine_scope(arena &a) noexcept : coroutine_scope(a.get()) {}
+
+  coroutine_scope(const coroutine_scope &) = delete;
+  coroutine_scope &operator=(const coroutine_scope &) = delete;
+
+  ~coroutine_scope()
+  {
+    coroutine_arena() = previous_;
+  }
+
+private:
+  MicroArena *previous_;
+};
+
+// Mixin for the promise_type of a C++20 coroutine, allocating its
+// frames from coroutine_arena: per thread, or per request with a
+// coroutine_scope around the request. Frames go through the size
+// classes of the arena when it has them, and to the heap when there
+// is no arena or it is full. A frame header records where it went,
+// so frames may outlive the scope that created them, not the arena.
+struct coroutine_promise
+{
+  static void *operator new(std::size_t size)
+  {
+    return allocate_frame(coroutine_arena(), size);
+  }
+
+  static void operator delete(void *ptr, std::size_t size) noexcept
+  {
+    char *frame = static_cast<char*>(ptr) - header_size;
+    MicroArena *ma = *reinterpret_cast<MicroArena**>(frame);
+    std::size_t total = size + header_size;
+    // Frames over the biggest class were aligned_alloc'ed like the
+    // frames of an arena without size classes
+    if (!ma)
+      ::operator delete(frame, total);
+    else if (pooled && size_class(total) < MICRO_ARENA_SIZE_CLASSES
+             && ma->size_classes)
+      micro_arena_class_free(ma, size_class(total), frame);
+    else
+      micro_arena_free_sized(ma, frame, total);
+  }
+
+private:
+  // The size classes are only used if they align frames like new
+  static constexpr bool pooled =
+    MICRO_ARENA_POOL_ALIGNMENT >= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+  // Keeps the frame aligned like new
+  static constexpr std::size_t header_size =
+    __STDCPP_DEFAULT_NEW_ALIGNMENT__ > sizeof(MicroArena*)
+    ? __STDCPP_DEFAULT_NEW_ALIGNMENT__ : sizeof(MicroArena*);
+
+  static void *allocate_frame(MicroArena *ma, std::size_t size)
+  {
+    if (size > std::numeric_limits<std::size_t>::max() - header_size)
+      throw std::bad_alloc();
+    std::size_t total = size + header_size;
+    void *frame = nullptr;
+    if (ma && pooled)
+      frame = micro_arena_class_malloc(ma, size_class(total), total);
+    else if (ma)
+      frame = micro_arena_aligned_alloc(ma, header_size, total);
+    if (!frame)
+    {
+      ma = nullptr;
+      frame = ::operator new(total);
+    }
+    *static_cast<MicroArena**>(frame) = ma;
+    return static_cast<char*>(frame) + header_size;
+  }
+};
+
+// Stateful allocator for standard containers. Copies allocate from
+// the same MicroArena, which must outlive them, and the arena moves
+// and swaps with the container.
+template <typename T>
+class allocator
+{
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  explicit allocator(MicroArena *ma) noexcept : ma_(ma) {}
+  allocator(const micro_arena::arena &a) noexcept : ma_(a.get()) {}
+
+  template <std::size_t Capacity, std::size_t MaxChunks,
+            MicroArenaPolicy Policy>
+  allocator(basic_arena<Capacity, MaxChunks, Policy> &a) noexcept
+    : ma_(a.get()) {}
+
+  template <typename U>
+  allocator(const allocator<U> &other) noexcept : ma_(other.arena()) {}
+
+  MicroArena *arena() const noexcept { return ma_; }
+
+  T *allocate(std::size_t n)
+  {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+      throw std::bad_array_new_length();
+    void *ptr = micro_arena_aligned_alloc(ma_, alignof(T), n * sizeof(T));
+    if (!ptr)
+      throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T *ptr, std::size_t n) noexcept
+  {
+    micro_arena_free_sized(ma_, ptr, n * sizeof(T));
+  }
+
+private:
+  MicroArena *ma_;
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+  return !(a == b);
+}
+
+} // namespace micro_arena
+
+#endif // __cplusplus >= 201703L
+
 #endif // MICRO_ARENA
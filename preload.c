@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// malloc interposer over a growable MicroArena, to run unmodified
+// programs on micro-arena:
+//
+//   make libmicroarena.so
+//   LD_PRELOAD=./libmicroarena.so ./program
+//
+// Every allocation comes from one arena shared by all the threads,
+// whose segments are mapped with mmap. Pointers the arena does not
+// own are ignored by free, and realloc fails on them with EINVAL
+// leaving them untouched. To record a trace for the replay tool:
+//
+//   MICRO_ARENA_TRACE_FILE=trace.bin LD_PRELOAD=./libmicroarena.so ./program
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void *preload_map(size_t size);
+
+#define MICRO_ARENA_MULTITHREADED
+#define MICRO_ARENA_TRACE
+#define MICRO_ARENA_STACK_MEM_SIZE (1 << 20)
+#define MICRO_ARENA_MAX_NUM_CHUNKS 4096
+#define MICRO_ARENA_BACKING_ALLOC(size) preload_map(size)
+#define MICRO_ARENA_BACKING_FREE(ptr, size) munmap((ptr), (size))
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+// Alignment of malloc, enough for any type
+#define PRELOAD_ALIGNMENT 16
+// Minimum size of the segments added when the arena is full
+#define PRELOAD_SEGMENT_SIZE (4 << 20)
+
+static MicroArenaInline preload_arena;
+static pthread_once_t preload_once = PTHREAD_ONCE_INIT;
+
+static void *preload_map(size_t size)
+{
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+static void preload_init(void)
+{
+  micro_arena_init(&preload_arena);
+  micro_arena_set_growth(&preload_arena.arena, PRELOAD_SEGMENT_SIZE);
+
+  // Neither getenv nor open allocate
+  const char *trace = getenv("MICRO_ARENA_TRACE_FILE");
+  if (trace)
+    micro_arena_trace_start(trace);
+}
+
+__attribute__((destructor)) static void preload_fini(void)
+{
+  micro_arena_trace_stop();
+}
+
+static MicroArena *preload_get(void)
+{
+  pthread_once(&preload_once, preload_init);
+  return &preload_arena.arena;
+}
+
+static void *preload_alloc(size_t alignment, size_t size)
+{
+  void *ptr = micro_arena_aligned_alloc(preload_get(), alignment, size);
+  if (!ptr)
+    errno = ENOMEM;
+  return ptr;
+}
+
+void *malloc(size_t size)
+{
+  return preload_alloc(PRELOAD_ALIGNMENT, size);
+}
+
+void free(void *ptr)
+{
+  if (ptr)
+    micro_arena_free(preload_get(), ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  if (size > 0 && nmemb > SIZE_MAX / size)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void *ptr = preload_alloc(PRELOAD_ALIGNMENT, nmemb * size);
+  if (ptr)
+    memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+// micro_arena_realloc does not keep the alignment of malloc
+void *realloc(void *ptr, size_t size)
+{
+  if (!ptr)
+    return malloc(size);
+
+  // Their size is unknown, copying none of it would lose the data
+  if (!micro_arena_owns(preload_get(), ptr))
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  size_t old_size = micro_arena_usable_size(preload_get(), ptr);
+  if (size <= old_size)
+    return ptr;
+
+  void *mem = malloc(size);
+  if (!mem)
+    return NULL;
+  memcpy(mem, ptr, old_size);
+  free(ptr);
+  return mem;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+  if (size > 0 && nmemb > SIZE_MAX / size)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, nmemb * size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  if (alignment % sizeof(void*) != 0
+      || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+
+  void *ptr = micro_arena_aligned_alloc(preload_get(), alignment, size);
+  if (!ptr)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  return preload_alloc(alignment < PRELOAD_ALIGNMENT
+                       ? PRELOAD_ALIGNMENT : alignment, size);
+}
+
+// Obsolete, but glibc would serve them otherwise
+void *memalign(size_t alignment, size_t size)
+{
+  return aligned_alloc(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+  return preload_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+  return ptr ? micro_arena_usable_size(preload_get(), ptr) : 0;
+}
@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Replay a trace recorded with MICRO_ARENA_TRACE on a fresh arena,
+// to tune it offline:
+//
+//   ./replay [-p first|next|best|worst|address] [-s bytes]
+//            [-c chunks] [-m min_split] trace
+//
+// The trace is replayed twice: once timed, for the throughput, and
+// once sampling micro_arena_stats, for the peak usage and
+// fragmentation. Records whose call failed are skipped.
+
+#define _POSIX_C_SOURCE 200809L
+#define MICRO_ARENA_STACK_MEM_SIZE 0
+#define MICRO_ARENA_MAX_NUM_CHUNKS 0
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPLAY_NONE UINT32_MAX
+// Operations between two samples of micro_arena_stats
+#define REPLAY_SAMPLE_INTERVAL 64
+
+// A record with its pointer ids turned into slots of one array
+typedef struct {
+  uint16_t op;         // MicroArenaTraceOp
+  uint32_t alignment;
+  uint64_t size;
+  uint32_t in;         // Slot freed or reallocated
+  uint32_t out;        // Slot allocated
+} ReplayOp;
+
+typedef struct {
+  ReplayOp *ops;
+  size_t num_ops;
+  size_t num_slots;
+} ReplayTrace;
+
+typedef struct {
+  size_t failures;
+  size_t peak_requested;
+  size_t peak_used;
+  size_t peak_free_chunks;
+  double peak_fragmentation;
+} ReplayResult;
+
+// Id to slot map with open addressing, ids are never 0. Freed ids
+// are not removed: the next allocation at the same address
+// overwrites them.
+typedef struct {
+  uint64_t *ids;
+  uint32_t *slots;
+  size_t mask;
+} ReplayMap;
+
+// Index of id, or of the empty entry where it would go
+static size_t replay_map_index(const ReplayMap *map, uint64_t id)
+{
+  // Fibonacci hashing, addresses share their low bits
+  size_t i = (size_t)((id * 0x9E3779B97F4A7C15ULL) >> 20) & map->mask;
+  while (map->ids[i] != 0 && map->ids[i] != id)
+    i = (i + 1) & map->mask;
+  return i;
+}
+
+static bool replay_load(const char *path, ReplayTrace *trace)
+{
+  bool ok = false;
+  MicroArenaTraceRecord *records = NULL;
+  ReplayMap map = { NULL, NULL, 0 };
+  size_t num_records = 0, num_allocs = 0, size = 16;
+  char magic[sizeof(MICRO_ARENA_TRACE_MAGIC) - 1];
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    goto exit;
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+      || memcmp(magic, MICRO_ARENA_TRACE_MAGIC, sizeof(magic)) != 0)
+    goto exit;
+  if (fseek(file, 0, SEEK_END) != 0)
+    goto exit;
+  num_records =
+    ((size_t)ftell(file) - sizeof(magic)) / sizeof(MicroArenaTraceRecord);
+  if (fseek(file, (long)sizeof(magic), SEEK_SET) != 0)
+    goto exit;
+
+  records = malloc(num_records * sizeof(MicroArenaTraceRecord) + 1);
+  trace->ops = malloc(num_records * sizeof(ReplayOp) + 1);
+  if (!records || !trace->ops)
+    goto exit;
+  if (fread(records, sizeof(MicroArenaTraceRecord), num_records, file)
+      != num_records)
+    goto exit;
+
+  for (size_t i = 0; i < num_records; ++i)
+    if (records[i].result != 0)
+      num_allocs++;
+  while (size < 2 * num_allocs)
+    size *= 2;
+  map.ids = calloc(size, sizeof(uint64_t));
+  map.slots = malloc(size * sizeof(uint32_t));
+  map.mask = size - 1;
+  if (!map.ids || !map.slots || num_allocs >= REPLAY_NONE)
+    goto exit;
+
+  trace->num_ops = 0;
+  trace->num_slots = 0;
+  for (size_t i = 0; i < num_records; ++i)
+  {
+    MicroArenaTraceRecord *record = &records[i];
+    ReplayOp *op = &trace->ops[trace->num_ops];
+    op->op = record->op;
+    op->alignment = record->alignment;
+    op->size = record->size;
+    op->in = REPLAY_NONE;
+    op->out = REPLAY_NONE;
+
+    if (record->ptr != 0)
+    {
+      size_t index = replay_map_index(&map, record->ptr);
+      if (map.ids[index] == record->ptr)
+        op->in = map.slots[index];
+    }
+    if (record->op != MICRO_ARENA_TRACE_FREE)
+    {
+      if (record->result == 0)
+        continue;
+      op->out = (uint32_t)trace->num_slots++;
+      // A realloc in place keeps the id
+      size_t index = replay_map_index(&map, record->result);
+      map.ids[index] = record->result;
+      map.slots[index] = op->out;
+    }
+    else if (op->in == REPLAY_NONE)
+      continue;
+    trace->num_ops++;
+  }
+  ok = true;
+
+ exit:
+  if (file)
+    fclose(file);
+  free(records);
+  free(map.ids);
+  free(map.slots);
+  return ok;
+}
+
+static void replay_run(MicroArena *ma, const ReplayTrace *trace,
+                       void **ptrs, size_t *sizes, ReplayResult *result)
+{
+  size_t requested = 0;
+  for (size_t i = 0; i < trace->num_ops; ++i)
+  {
+    const ReplayOp *op = &trace->ops[i];
+    void *ptr = NULL;
+    switch (op->op)
+    {
+    case MICRO_ARENA_TRACE_MALLOC:
+      ptr = micro_arena_malloc(ma, op->size);
+      break;
+    case MICRO_ARENA_TRACE_ALIGNED_ALLOC:
+      ptr = micro_arena_aligned_alloc(ma, op->alignment, op->size);
+      break;
+    case MICRO_ARENA_TRACE_REALLOC:
+      ptr = micro_arena_realloc(ma, op->in == REPLAY_NONE
+                                ? NULL : ptrs[op->in], op->size);
+      break;
+    case MICRO_ARENA_TRACE_FREE:
+      micro_arena_free(ma, ptrs[op->in]);
+      break;
+    default:
+      break;
+    }
+
+    if (op->op != MICRO_ARENA_TRACE_FREE && !ptr)
+    {
+      result->failures++;
+      continue;
+    }
+    if (op->in != REPLAY_NONE)
+    {
+      ptrs[op->in] = NULL;
+      if (sizes)
+        requested -= sizes[op->in];
+    }
+    if (op->out != REPLAY_NONE)
+    {
+      ptrs[op->out] = ptr;
+      if (sizes)
+      {
+        sizes[op->out] = op->size;
+        requested += op->size;
+      }
+    }
+
+    // Only when measuring, not when timing
+    if (!sizes)
+      continue;
+    if (requested > result->peak_requested)
+      result->peak_requested = requested;
+    if (i % REPLAY_SAMPLE_INTERVAL == 0 || i + 1 == trace->num_ops)
+    {
+      MicroArenaStats stats;
+      micro_arena_stats(ma, &stats);
+      if (stats.total_used > result->peak_used)
+        result->peak_used = stats.total_used;
+      if (stats.free_chunks > result->peak_free_chunks)
+        result->peak_free_chunks = stats.free_chunks;
+      if (stats.fragmentation > result->peak_fragmentation)
+        result->peak_fragmentation = stats.fragmentation;
+    }
+  }
+  return;
+}
+
+static bool replay_parse_policy(const char *name, MicroArenaPolicy *policy)
+{
+  static const char *names[] = { "first", "next", "best", "worst",
+                                 "address" };
+  static const MicroArenaPolicy policies[] = {
+    MICRO_ARENA_FIRST_FIT, MICRO_ARENA_NEXT_FIT, MICRO_ARENA_BEST_FIT,
+    MICRO_ARENA_WORST_FIT, MICRO_ARENA_ADDRESS_ORDERED_FIT,
+  };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+  {
+    if (strcmp(name, names[i]) == 0)
+    {
+      *policy = policies[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+static int replay_usage(const char *program)
+{
+  fprintf(stderr, "usage: %s [-p first|next|best|worst|address] "
+          "[-s bytes] [-c chunks] [-m min_split] trace\n", program);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  MicroArenaPolicy policy = MICRO_ARENA_DEFAULT_POLICY;
+  size_t capacity = 64 << 20, max_chunks = 1 << 16;
+  size_t min_split = MICRO_ARENA_DEFAULT_MIN_SPLIT;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+    {
+      if (!replay_parse_policy(argv[++i], &policy))
+        return replay_usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      capacity = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      max_chunks = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      min_split = strtoull(argv[++i], NULL, 0);
+    else if (!path && argv[i][0] != '-')
+      path = argv[i];
+    else
+      return replay_usage(argv[0]);
+  }
+  if (!path)
+    return replay_usage(argv[0]);
+
+  ReplayTrace trace = { NULL, 0, 0 };
+  if (!replay_load(path, &trace))
+  {
+    fprintf(stderr, "%s: can not read the trace %s\n", argv[0], path);
+    free(trace.ops);
+    return 1;
+  }
+
+  char *mem = malloc(capacity + 1);
+  MicroArenaSize *chunks = malloc(4 * max_chunks * sizeof(MicroArenaSize)
+                                  + 1);
+  void **ptrs = calloc(trace.num_slots + 1, sizeof(void*));
+  size_t *sizes = calloc(trace.num_slots + 1, sizeof(size_t));
+  MicroArena ma;
+  if (!mem || !chunks || !ptrs || !sizes
+      || !micro_arena_init_chunks(&ma, mem, capacity, chunks, max_chunks))
+  {
+    fprintf(stderr, "%s: can not set up an arena of %zu bytes\n",
+            argv[0], capacity);
+    return 1;
+  }
+  micro_arena_set_policy(&ma, policy);
+  micro_arena_set_min_split(&ma, min_split);
+
+  ReplayResult timed, measured;
+  memset(&timed, 0, sizeof(timed));
+  memset(&measured, 0, sizeof(measured));
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  replay_run(&ma, &trace, ptrs, NULL, &timed);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (double)(end.tv_sec - start.tv_sec)
+    + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  micro_arena_reset(&ma);
+  memset(ptrs, 0, (trace.num_slots + 1) * sizeof(void*));
+  replay_run(&ma, &trace, ptrs, sizes, &measured);
+
+  printf("ops:                %zu\n", trace.num_ops);
+  printf("failures:           %zu\n", timed.failures);
+  printf("seconds:            %.6f\n", seconds);
+  printf("Mops/s:             %.2f\n",
+         seconds > 0 ? (double)trace.num_ops / seconds / 1e6 : 0.0);
+  printf("peak requested:     %zu\n", measured.peak_requested);
+  printf("peak used:          %zu\n", measured.peak_used);
+  printf("peak free chunks:   %zu\n", measured.peak_free_chunks);
+  printf("peak fragmentation: %.3f\n", measured.peak_fragmentation);
+
+  micro_arena_destroy(&ma);
+  free(trace.ops);
+  free(mem);
+  free(chunks);
+  free(ptrs);
+  free(sizes);
+  return 0;
+}
@@ -3,54 +3,892 @@
 // Mail:    giovanni.santini@proton.me
 // Github:  @San7o
 
+#define _POSIX_C_SOURCE 200809L
 #define MICRO_ARENA_MULTITHREADED
 #define MICRO_ARENA_DEBUG
+#define MICRO_ARENA_TRACE
 #define MICRO_ARENA_IMPLEMENTATION
 #include "micro-arena.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+
+MICRO_ARENA_DEFINE(TinyArena, 256, 4)
+
+void test_stats(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  MicroArenaStats stats;
+  micro_arena_stats(ma, &stats);
+  assert(stats.total_free == MICRO_ARENA_STACK_MEM_SIZE);
+  assert(stats.largest_free == MICRO_ARENA_STACK_MEM_SIZE);
+  assert(stats.fragmentation == 0.0);
+
+  // Free every other block to leave holes of 64 bytes
+  void* blocks[8];
+  for (int i = 0; i < 8; ++i)
+  {
+    blocks[i] = micro_arena_malloc(ma, 64);
+    assert(blocks[i] != NULL);
+  }
+  for (int i = 0; i < 8; i += 2)
+    micro_arena_free(ma, blocks[i]);
+
+  micro_arena_stats(ma, &stats);
+  assert(stats.total_used == 4 * 64);
+  assert(stats.total_free == MICRO_ARENA_STACK_MEM_SIZE - 4 * 64);
+  assert(stats.free_chunks == 5);
+  assert(stats.histogram[6] == 4);
+  assert(stats.fragmentation > 0.0);
+
+  char map[17];
+  assert(micro_arena_heap_map(ma, map, sizeof(map)) == 16);
+  assert(strlen(map) == 16);
+  assert(map[0] == '+');
+  assert(map[15] == '.');
+
+  for (int i = 1; i < 8; i += 2)
+    micro_arena_free(ma, blocks[i]);
+
+  micro_arena_stats(ma, &stats);
+  assert(stats.total_free == MICRO_ARENA_STACK_MEM_SIZE);
+  assert(stats.free_chunks == 1);
+  assert(stats.fragmentation == 0.0);
+}
+
+void test_policies(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  // Leave a 100 bytes hole and a 40 bytes hole before the tail
+  char* a = micro_arena_malloc(ma, 100);
+  char* b = micro_arena_malloc(ma, 16);
+  char* c = micro_arena_malloc(ma, 40);
+  char* d = micro_arena_malloc(ma, 16);
+  assert(a && b && c && d);
+  micro_arena_free(ma, a);
+  micro_arena_free(ma, c);
+  char* tail = d + 16;
+
+  micro_arena_set_policy(ma, MICRO_ARENA_BEST_FIT);
+  char* p = micro_arena_malloc(ma, 30);
+  assert(p == c);
+  micro_arena_free(ma, p);
+
+  micro_arena_set_policy(ma, MICRO_ARENA_ADDRESS_ORDERED_FIT);
+  p = micro_arena_malloc(ma, 30);
+  assert(p == a);
+  micro_arena_free(ma, p);
+
+  micro_arena_set_policy(ma, MICRO_ARENA_WORST_FIT);
+  p = micro_arena_malloc(ma, 30);
+  assert(p == tail);
+  micro_arena_free(ma, p);
+
+  micro_arena_set_policy(ma, MICRO_ARENA_NEXT_FIT);
+  p = micro_arena_malloc(ma, 30);
+  char* q = micro_arena_malloc(ma, 30);
+  assert(p && q && p != q);
+  micro_arena_free(ma, p);
+  micro_arena_free(ma, q);
+
+  micro_arena_free(ma, b);
+  micro_arena_free(ma, d);
+  MicroArenaStats stats;
+  micro_arena_stats(ma, &stats);
+  assert(stats.total_free == MICRO_ARENA_STACK_MEM_SIZE);
+}
+
+void test_find_fit(void)
+{
+  static MicroArenaSize offsets[64], sizes[64];
+  MicroArenaChunkList list;
+  micro_arena_chunk_list_init(&list, offsets, sizes, 64);
+  for (size_t i = 0; i < 37; ++i)
+    assert(micro_arena_chunk_list_add(&list, 0, i % 7));
+  assert(micro_arena_chunk_list_add(&list, 0, MICRO_ARENA_SIZE_MAX));
+
+  assert(micro_arena_chunk_list_find_fit(&list, 0, 0) == 0);
+  assert(micro_arena_chunk_list_find_fit(&list, 6, 0) == 6);
+  assert(micro_arena_chunk_list_find_fit(&list, 6, 7) == 13);
+  assert(micro_arena_chunk_list_find_fit(&list, 3, 33) == 33);
+  assert(micro_arena_chunk_list_find_fit(&list, 7, 0) == 37);
+  assert(micro_arena_chunk_list_find_fit(&list, MICRO_ARENA_SIZE_MAX, 0) == 37);
+
+  micro_arena_chunk_list_remove_at(&list, 37);
+  assert(micro_arena_chunk_list_find_fit(&list, 7, 0) == list.len);
+}
+
+void test_rounding(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  assert(micro_arena_round_size(ma, 13) == 13);
+  micro_arena_set_rounding(ma, MICRO_ARENA_ROUND_GRANULE, 16);
+  assert(micro_arena_round_size(ma, 1) == 16);
+  assert(micro_arena_round_size(ma, 16) == 16);
+  assert(micro_arena_round_size(ma, 17) == 32);
+  assert(micro_arena_round_size(ma, SIZE_MAX) == 0);
+  micro_arena_set_rounding(ma, MICRO_ARENA_ROUND_GEOMETRIC, 16);
+  assert(micro_arena_round_size(ma, 17) == 32);
+  assert(micro_arena_round_size(ma, 33) == 48);
+  assert(micro_arena_round_size(ma, 65) == 80);
+  assert(micro_arena_round_size(ma, 1000) == 1024);
+
+  micro_arena_set_rounding(ma, MICRO_ARENA_ROUND_GRANULE, 16);
+  char* a = micro_arena_malloc(ma, 10);
+  char* b = micro_arena_malloc(ma, 10);
+  assert(b - a == 16);
+  micro_arena_free(ma, a);
+  micro_arena_free(ma, b);
+
+  // A remainder smaller than min_split is absorbed
+  micro_arena_set_rounding(ma, MICRO_ARENA_ROUND_NONE, 0);
+  micro_arena_set_min_split(ma, 16);
+  a = micro_arena_malloc(ma, MICRO_ARENA_STACK_MEM_SIZE - 64);
+  b = micro_arena_malloc(ma, 60);
+  assert(a && b);
+  assert(ma->free_chunks.len == 0);
+  assert(micro_arena_malloc(ma, 1) == NULL);
+  micro_arena_free(ma, b);
+  assert(ma->free_chunks.len == 1);
+  assert(ma->free_chunks.sizes[0] == 64);
+  micro_arena_free(ma, a);
+
+  MicroArenaStats stats;
+  micro_arena_stats(ma, &stats);
+  assert(stats.total_free == MICRO_ARENA_STACK_MEM_SIZE);
+}
+
+void test_pool(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  MicroArenaPool pool;
+  assert(micro_arena_pool_init(&pool, ma, 24, 4, false));
+  assert(pool.slot_size == 32);
+  assert(ma->used_chunks.len == 1);
+
+  void* slots[5];
+  for (int i = 0; i < 4; ++i)
+  {
+    slots[i] = micro_arena_pool_alloc(&pool);
+    assert(slots[i] != NULL);
+    assert((uintptr_t)slots[i] % MICRO_ARENA_POOL_ALIGNMENT == 0);
+    memset(slots[i], 0xAB, 24);
+  }
+  assert(micro_arena_pool_alloc(&pool) == NULL);
+
+  // Freed slots are reused last in, first out
+  micro_arena_pool_free(&pool, slots[1]);
+  micro_arena_pool_free(&pool, slots[3]);
+  assert(micro_arena_pool_alloc(&pool) == slots[3]);
+  assert(micro_arena_pool_alloc(&pool) == slots[1]);
+
+  pool.grow = true;
+  slots[4] = micro_arena_pool_alloc(&pool);
+  assert(slots[4] != NULL);
+  assert(ma->used_chunks.len == 2);
+
+  micro_arena_pool_destroy(&pool);
+  assert(ma->used_chunks.len == 0);
+  assert(ma->free_chunks.len == 1);
+}
+
+void test_buddy(void)
+{
+  static char mem[8192 + 1024];
+  MicroArenaBuddy buddy;
+  assert(micro_arena_buddy_init(&buddy, mem, sizeof(mem)));
+  assert((uintptr_t)buddy.base % MICRO_ARENA_BUDDY_MIN_BLOCK == 0);
+  assert(buddy.base + buddy.size <= mem + sizeof(mem));
+
+  char* a = micro_arena_buddy_malloc(&buddy, 100);
+  char* b = micro_arena_buddy_malloc(&buddy, 128);
+  char* c = micro_arena_buddy_malloc(&buddy, 1);
+  assert(a && b && c);
+  assert(micro_arena_buddy_block_size(&buddy, a) == 128);
+  assert(micro_arena_buddy_block_size(&buddy, c) == MICRO_ARENA_BUDDY_MIN_BLOCK);
+  // Blocks are aligned to their size
+  assert((uintptr_t)a % 128 == 0 && (uintptr_t)b % 128 == 0);
+  assert(micro_arena_buddy_block_size(&buddy, a + 1) == 0);
+  assert(micro_arena_buddy_malloc(&buddy, 8192) == NULL);
+
+  micro_arena_buddy_free(&buddy, a);
+  micro_arena_buddy_free(&buddy, a);
+  assert(micro_arena_buddy_block_size(&buddy, a) == 0);
+  micro_arena_buddy_free(&buddy, b);
+  micro_arena_buddy_free(&buddy, c);
+
+  // Everything merged back: the biggest block fits again
+  char* big = micro_arena_buddy_malloc(&buddy, 4096);
+  assert(big != NULL);
+  micro_arena_buddy_free(&buddy, big);
+}
+
+void test_bitmap(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  MicroArenaBitmap bitmap;
+  assert(micro_arena_bitmap_init(&bitmap, ma, 8, 70));
+  assert(bitmap.num_words == 2);
+  assert(ma->used_chunks.len == 1);
+
+  char* blocks[70];
+  for (int i = 0; i < 70; ++i)
+  {
+    blocks[i] = micro_arena_bitmap_alloc(&bitmap);
+    assert(blocks[i] != NULL);
+    assert((uintptr_t)blocks[i] % 8 == 0);
+    assert(micro_arena_bitmap_owns(&bitmap, blocks[i]));
+    if (i > 0)
+      assert(blocks[i] - blocks[i - 1] == 8);
+  }
+  assert(micro_arena_bitmap_alloc(&bitmap) == NULL);
+
+  micro_arena_bitmap_free(&bitmap, blocks[65]);
+  micro_arena_bitmap_free(&bitmap, blocks[3]);
+  assert(micro_arena_bitmap_alloc(&bitmap) == blocks[3]);
+  assert(micro_arena_bitmap_alloc(&bitmap) == blocks[65]);
+  assert(!micro_arena_bitmap_owns(&bitmap, blocks[69] + 8));
+
+  // Pointers inside a block and repeated frees are ignored
+  micro_arena_bitmap_free(&bitmap, blocks[10] + 1);
+  micro_arena_bitmap_free(&bitmap, blocks[20]);
+  micro_arena_bitmap_free(&bitmap, blocks[20]);
+  assert(micro_arena_bitmap_alloc(&bitmap) == blocks[20]);
+  assert(micro_arena_bitmap_alloc(&bitmap) == NULL);
+
+  micro_arena_bitmap_destroy(&bitmap);
+  assert(ma->used_chunks.len == 0);
+}
+
+void test_stack(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  MicroArenaStack stack;
+  assert(micro_arena_stack_init(&stack, ma, 256));
+
+  char* a = micro_arena_stack_alloc(&stack, 10);
+  char* b = micro_arena_stack_alloc(&stack, 20);
+  char* c = micro_arena_stack_alloc(&stack, 30);
+  assert(a && b && c);
+  assert((uintptr_t)b % MICRO_ARENA_STACK_ALIGNMENT == 0);
+  assert(micro_arena_stack_alloc(&stack, 256) == NULL);
+
+  // Out of order frees wait for the blocks above them
+  size_t top = stack.top;
+  micro_arena_stack_free(&stack, b);
+  assert(stack.top == top);
+  micro_arena_stack_free(&stack, c);
+  assert(stack.top == (size_t)(b - stack.base) - sizeof(MicroArenaStackHeader));
+
+  // The space is reused
+  assert(micro_arena_stack_alloc(&stack, 20) == b);
+
+  // Stale, inner and repeated frees are ignored
+  top = stack.top;
+  micro_arena_stack_free(&stack, c);
+  micro_arena_stack_free(&stack, b + 8);
+  char* d = micro_arena_stack_alloc(&stack, 10);
+  char* e = micro_arena_stack_alloc(&stack, 10);
+  micro_arena_stack_free(&stack, d);
+  micro_arena_stack_free(&stack, d);
+  assert(stack.top == (size_t)(e - stack.base) + 10);
+  micro_arena_stack_free(&stack, e);
+  assert(stack.top == (size_t)(d - stack.base) - sizeof(MicroArenaStackHeader));
+  assert(stack.top >= top);
+  micro_arena_stack_reset(&stack);
+  assert(micro_arena_stack_alloc(&stack, 10) == a);
+
+  micro_arena_stack_destroy(&stack);
+  assert(ma->used_chunks.len == 0);
+}
+
+void test_ring(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  // Four blocks of 48 bytes, header included
+  MicroArenaRing ring;
+  assert(micro_arena_ring_init(&ring, ma, 4 * 48));
+
+  char* a = micro_arena_ring_alloc(&ring, 32);
+  char* b = micro_arena_ring_alloc(&ring, 32);
+  char* c = micro_arena_ring_alloc(&ring, 32);
+  assert(a && b && c);
+  assert(b - a == 48 && c - b == 48);
+
+  // Freeing a newer block does not move the tail
+  micro_arena_ring_free(&ring, b);
+  assert(ring.tail == 0);
+  micro_arena_ring_free(&ring, a);
+  assert(ring.tail == 96);
+
+  // Stale, inner and repeated frees are ignored
+  micro_arena_ring_free(&ring, a);
+  micro_arena_ring_free(&ring, b);
+  micro_arena_ring_free(&ring, c + 16);
+  assert(ring.tail == 96 && ring.used == 48);
+
+  // 64 bytes do not fit before the end, the remainder is skipped
+  char* d = micro_arena_ring_alloc(&ring, 60);
+  assert(d == a);
+  assert(micro_arena_ring_alloc(&ring, 60) == NULL);
+  assert(micro_arena_ring_alloc(&ring, 16) == NULL);
+  char* e = micro_arena_ring_alloc(&ring, 0);
+  assert(e == c - 16);
+  assert(micro_arena_ring_alloc(&ring, 1) == NULL);
+
+  micro_arena_ring_free(&ring, c);
+  assert(ring.tail == 0);
+  micro_arena_ring_free(&ring, e);
+  micro_arena_ring_free(&ring, d);
+  assert(ring.used == 0 && ring.head == 0);
+
+  micro_arena_ring_destroy(&ring);
+  assert(ma->used_chunks.len == 0);
+}
+
+void test_frame(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  MicroArenaFrame frame;
+  assert(micro_arena_frame_init(&frame, ma, 100, 2));
+  assert(frame.region_size == 112);
+
+  char* a = micro_arena_frame_alloc(&frame, 10);
+  char* b = micro_arena_frame_alloc(&frame, 10);
+  assert(a && b && b - a == 16);
+  assert(micro_arena_frame_alloc(&frame, 96) == NULL);
+  assert(micro_arena_frame_alloc(&frame, 80) != NULL);
+  a[0] = 'a';
+
+  // The previous frame stays readable
+  micro_arena_frame_begin(&frame);
+  char* c = micro_arena_frame_alloc(&frame, 112);
+  assert(c == a + 112);
+  assert(a[0] == 'a');
+
+  // The third frame reuses the first region
+  micro_arena_frame_begin(&frame);
+  assert(micro_arena_frame_alloc(&frame, 10) == a);
+
+  micro_arena_frame_destroy(&frame);
+  assert(ma->used_chunks.len == 0);
+}
+
+void test_cache(void)
+{
+  static MicroArenaInline arenas[2];
+  MicroArenaCache cache;
+  assert(!micro_arena_cache_init(&cache, arenas, 0));
+  assert(micro_arena_cache_init(&cache, arenas, 2));
+
+  MicroArena* a = micro_arena_cache_acquire(&cache);
+  MicroArena* b = micro_arena_cache_acquire(&cache);
+  assert(a == &arenas[0].arena && b == &arenas[1].arena);
+  assert(micro_arena_cache_acquire(&cache) == NULL);
+
+  micro_arena_set_policy(a, MICRO_ARENA_BEST_FIT);
+  assert(micro_arena_malloc(a, 100) && micro_arena_malloc(a, 200));
+
+  // Released arenas come back empty with the same settings
+  micro_arena_cache_release(&cache, a);
+  assert(micro_arena_cache_acquire(&cache) == a);
+  assert(a->used_chunks.len == 0 && a->free_chunks.len == 1);
+  assert(a->free_chunks.sizes[0] == MICRO_ARENA_STACK_MEM_SIZE);
+  assert(a->policy == MICRO_ARENA_BEST_FIT);
+
+  // Arenas of other caches are left alone
+  static MicroArenaInline other;
+  micro_arena_init(&other);
+  micro_arena_cache_release(&cache, &other.arena);
+  assert(cache.num_idle == 0);
+
+  // Segments beyond the retained bytes are given back on release
+  micro_arena_set_growth(a, 256);
+  assert(micro_arena_malloc(a, MICRO_ARENA_STACK_MEM_SIZE + 1));
+  assert(a->next != NULL);
+  micro_arena_cache_release(&cache, a);
+  assert(micro_arena_cache_acquire(&cache) == a && a->next != NULL);
+  micro_arena_cache_set_retain(&cache, 0);
+  assert(cache.retain == 0);
+  micro_arena_cache_release(&cache, a);
+  assert(micro_arena_cache_acquire(&cache) == a && a->next == NULL);
+
+  micro_arena_cache_release(&cache, a);
+  micro_arena_cache_release(&cache, b);
+  assert(cache.num_idle == 2);
+  micro_arena_cache_destroy(&cache);
+}
+
+void test_child(void)
+{
+  MicroArenaInline parent_inl;
+  MicroArena *parent = &parent_inl.arena;
+  micro_arena_init(&parent_inl);
+  assert(parent->base == parent_inl.mem);
+  assert(parent->capacity == MICRO_ARENA_STACK_MEM_SIZE);
+
+  static char buf[256];
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  assert(!micro_arena_init_buffer(&inl, NULL, 256));
+  assert(micro_arena_init_buffer(&inl, buf, sizeof(buf)));
+  char* p = micro_arena_malloc(ma, 200);
+  assert(p == buf);
+  assert(micro_arena_malloc(ma, 100) == NULL);
+  micro_arena_free(ma, p);
+  assert(ma->free_chunks.len == 1 && ma->free_chunks.sizes[0] == 256);
+
+  MicroArenaInline child_inl;
+  MicroArena *child = &child_inl.arena;
+  assert(!micro_arena_init_child(parent, &child_inl,
+                                 MICRO_ARENA_STACK_MEM_SIZE + 1));
+  assert(micro_arena_init_child(parent, &child_inl, 512));
+  assert(micro_arena_owns(parent, child->base));
+  for (int i = 0; i < 8; ++i)
+  {
+    char* q = micro_arena_malloc(child, 32);
+    assert(q && micro_arena_owns(child, q));
+  }
+  assert(child->used_chunks.len == 8);
+
+  // One free on the parent releases the whole child
+  micro_arena_free(parent, child->base);
+  assert(parent->used_chunks.len == 0);
+}
+
+void test_compact(void)
+{
+  #if defined(MICRO_ARENA_COMPACT_16)
+  assert(sizeof(MicroArenaSize) == 2);
+  #elif defined(MICRO_ARENA_COMPACT)
+  assert(sizeof(MicroArenaSize) == 4);
+  #else
+  assert(sizeof(MicroArenaSize) == sizeof(size_t));
+  #endif
+
+  #if MICRO_ARENA_SIZE_MAX < SIZE_MAX
+  // Capacities that do not fit the offsets and sizes are rejected
+  // before buf is touched, and so are segments of the same size
+  static char buf[256];
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  assert(!micro_arena_init_buffer(&inl, buf,
+                                  (size_t)MICRO_ARENA_SIZE_MAX + 1));
+  assert(micro_arena_init_buffer(&inl, buf, sizeof(buf)));
+  micro_arena_set_growth(ma, 256);
+  assert(micro_arena_malloc(ma, (size_t)MICRO_ARENA_SIZE_MAX + 1) == NULL);
+  assert(ma->next == NULL);
+  assert(micro_arena_malloc(ma, 512) != NULL);
+  assert(ma->next != NULL);
+  micro_arena_destroy(ma);
+  #endif
+}
+
+void test_reset(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+  micro_arena_set_policy(ma, MICRO_ARENA_BEST_FIT);
+  assert(micro_arena_malloc(ma, 100) && micro_arena_malloc(ma, 200));
+  micro_arena_reset(ma);
+  assert(ma->used_chunks.len == 0 && ma->free_chunks.len == 1);
+  assert(ma->free_chunks.sizes[0] == MICRO_ARENA_STACK_MEM_SIZE);
+  assert(ma->policy == MICRO_ARENA_BEST_FIT);
+
+  // Without growth a full arena fails
+  char* a = micro_arena_malloc(ma, MICRO_ARENA_STACK_MEM_SIZE);
+  assert(a != NULL);
+  assert(micro_arena_malloc(ma, 16) == NULL);
+
+  micro_arena_set_growth(ma, 1024);
+  char* b = micro_arena_malloc(ma, 16);
+  char* c = micro_arena_malloc(ma, 2 * MICRO_ARENA_STACK_MEM_SIZE);
+  assert(b && c && ma->next && ma->next->next);
+  assert(micro_arena_owns(ma, b) && micro_arena_owns(ma, c));
+  assert(micro_arena_segment_of(ma, c) == ma->next);
+  assert(ma->next->capacity == 2 * MICRO_ARENA_STACK_MEM_SIZE);
+
+  // Frees and reallocs find the segment
+  b = micro_arena_realloc(ma, b, 32);
+  assert(b && micro_arena_owns(ma, b));
+  micro_arena_free(ma, b);
+  micro_arena_free(ma, c);
+  assert(ma->next->used_chunks.len == 0 && ma->next->next->used_chunks.len == 0);
+
+  // Only the oldest segment fits in the retained bytes
+  assert(micro_arena_malloc(ma, 16) != NULL);
+  micro_arena_reset_retain(ma, MICRO_ARENA_STACK_MEM_SIZE);
+  assert(ma->next && ma->next->next == NULL);
+  assert(ma->next->used_chunks.len == 0);
+  assert(ma->used_chunks.len == 0);
+
+  micro_arena_destroy(ma);
+  assert(ma->next == NULL);
+}
+
+static char cleanup_log[8];
+static size_t cleanup_log_len;
+
+static void test_cleanup_fn(void *ctx)
+{
+  cleanup_log[cleanup_log_len++] = *(char*)ctx;
+}
+
+void test_cleanup(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  static char names[] = "abc";
+  assert(!micro_arena_register_cleanup(ma, NULL, NULL));
+  for (int i = 0; i < 3; ++i)
+  {
+    assert(micro_arena_malloc(ma, 1) != NULL);
+    assert(micro_arena_register_cleanup(ma, test_cleanup_fn, &names[i]));
+    assert((uintptr_t)ma->cleanups % sizeof(void*) == 0);
+  }
+
+  // Newest first, once
+  micro_arena_reset(ma);
+  assert(cleanup_log_len == 3);
+  assert(memcmp(cleanup_log, "cba", 3) == 0);
+  assert(ma->cleanups == NULL && ma->used_chunks.len == 0);
+  micro_arena_reset(ma);
+  assert(cleanup_log_len == 3);
+
+  assert(micro_arena_register_cleanup(ma, test_cleanup_fn, &names[0]));
+  micro_arena_destroy(ma);
+  assert(cleanup_log_len == 4 && cleanup_log[3] == 'a');
+}
+
+void test_aligned_alloc(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  assert(micro_arena_aligned_alloc(ma, 3, 8) == NULL);
+  char* a = micro_arena_aligned_alloc(ma, 1, 3);
+  char* b = micro_arena_aligned_alloc(ma, 64, 100);
+  assert(a && b && (uintptr_t)b % 64 == 0);
+
+  // The padding and the tail went back to the arena, b keeps a
+  // whole multiple of its alignment
+  MicroArenaStats stats;
+  micro_arena_stats(ma, &stats);
+  assert(stats.total_used == 3 + 128);
+  char* c = micro_arena_aligned_alloc(ma, 64, 1);
+  assert(c == b + 128);
+  micro_arena_free(ma, c);
+
+  b = micro_arena_realloc(ma, b, 200);
+  assert(b != NULL);
+  micro_arena_free(ma, b);
+  micro_arena_free(ma, a);
+  assert(ma->used_chunks.len == 0 && ma->free_chunks.len == 1);
+}
+
+void test_define(void)
+{
+  TinyArena a;
+  TinyArena_init(&a);
+  MicroArena *ma = TinyArena_arena(&a);
+  assert(ma->base == a.mem && ma->capacity == 256);
+  assert(ma->free_chunks.cap == 4);
+  // A MicroArena and its own storage, not the one of MicroArenaInline
+  assert(sizeof(TinyArena) < sizeof(MicroArena) + 256
+         + 16 * sizeof(MicroArenaSize) + 16);
+  assert(sizeof(MicroArena) < sizeof(MicroArenaInline));
+
+  // Four used chunks at most
+  char* p[4];
+  for (int i = 0; i < 4; ++i)
+  {
+    p[i] = TinyArena_malloc(&a, 16);
+    assert(p[i] == a.mem + 16 * i);
+  }
+  assert(TinyArena_malloc(&a, 16) == NULL);
+  TinyArena_free(&a, p[1]);
+  p[1] = TinyArena_realloc(&a, p[0], 32);
+  assert(p[1] != NULL);
+
+  TinyArena_reset(&a);
+  assert(ma->used_chunks.len == 0);
+  assert(TinyArena_calloc(&a, 32, 8) == a.mem);
+  assert(TinyArena_malloc(&a, 1) == NULL);
+}
+
+void test_size_classes(void)
+{
+  typedef struct { char payload[40]; } Node;
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  // Without size classes the arena serves the objects
+  Node *n = MICRO_ARENA_NEW(ma, Node);
+  assert(n != NULL && (uintptr_t)n % MICRO_ARENA_POOL_ALIGNMENT == 0);
+  MICRO_ARENA_DELETE(ma, n);
+  assert(ma->used_chunks.len == 0);
+
+  assert(MICRO_ARENA_SIZE_CLASS(1) == 0);
+  assert(MICRO_ARENA_SIZE_CLASS(sizeof(Node)) == 2);
+  assert(MICRO_ARENA_SIZE_CLASS(1 << 20) == MICRO_ARENA_SIZE_CLASSES);
+
+  MicroArenaSizeClasses classes;
+  assert(micro_arena_size_classes_init(&classes, ma, 8));
+  assert(ma->used_chunks.len == 0);
+
+  // One slab for the first eight nodes
+  Node *nodes[9];
+  for (int i = 0; i < 9; ++i)
+    nodes[i] = MICRO_ARENA_NEW(ma, Node);
+  assert(ma->used_chunks.len == 2);
+  assert((char*)nodes[1] == (char*)nodes[0] + 64);
+  MICRO_ARENA_DELETE(ma, nodes[3]);
+  assert(MICRO_ARENA_NEW(ma, Node) == nodes[3]);
+
+  micro_arena_reset(ma);
+  assert(classes.pools[2].slabs == NULL);
+  n = MICRO_ARENA_NEW(ma, Node);
+  assert(n != NULL && ma->used_chunks.len == 1);
+
+  micro_arena_size_classes_destroy(&classes);
+  assert(ma->size_classes == NULL && ma->used_chunks.len == 0);
+  micro_arena_destroy(ma);
+}
+
+void test_usable_size(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  char* a = micro_arena_malloc(ma, 10);
+  char* b = micro_arena_aligned_alloc(ma, 16, 20);
+  assert(micro_arena_usable_size(ma, a) == 10);
+  assert(micro_arena_usable_size(ma, b) == 32);
+  assert(micro_arena_usable_size(ma, a + 1) == 0);
+  int outside;
+  assert(micro_arena_usable_size(ma, &outside) == 0);
+
+  // Overflowing sizes fail instead of wrapping around
+  assert(micro_arena_calloc(ma, SIZE_MAX / 2, 4) == NULL);
+  assert(micro_arena_reallocarray(ma, a, SIZE_MAX / 2, 4) == NULL);
+  micro_arena_destroy(ma);
+}
+
+void test_free_sized(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  char* a = micro_arena_malloc(ma, 10);
+  char* b = micro_arena_aligned_alloc(ma, 64, 20);
+  char* c = micro_arena_malloc(ma, 30);
+  assert(a && b && c);
+
+  // A size bigger than the allocation does not match it
+  micro_arena_free_sized(ma, c, 31);
+  assert(micro_arena_usable_size(ma, c) == 30);
+  micro_arena_free_sized(ma, c, 30);
+  micro_arena_free_sized(ma, b, 20);
+  micro_arena_free_sized(ma, a, 10);
+  assert(ma->used_chunks.len == 0);
+  assert(ma->free_chunks.len == 1);
+  micro_arena_destroy(ma);
+}
+
+// Threads mixing malloc, aligned_alloc and realloc while the arena grows
+#define TEST_GROWTH_THREADS 4
+#define TEST_GROWTH_LIVE    16
+
+static MicroArena test_growth_arena;
+
+static void *test_growth_thread(void *arg)
+{
+  MicroArena *ma = &test_growth_arena;
+  void *live[TEST_GROWTH_LIVE] = { NULL };
+  size_t seed = (size_t)arg;
+  for (size_t i = 0; i < 200; ++i)
+  {
+    size_t slot = (seed + i * 7) % TEST_GROWTH_LIVE;
+    size_t size = 16 + (seed * 31 + i * 13) % 200;
+    if (i % 3 == 2 && live[slot])
+    {
+      // Filled with seed below, realloc keeps the first bytes
+      live[slot] = micro_arena_realloc(ma, live[slot], size);
+      assert(live[slot] != NULL);
+      assert(*(unsigned char*)live[slot] == (unsigned char)seed);
+    }
+    else
+    {
+      micro_arena_free(ma, live[slot]);
+      live[slot] = (i % 2 == 0) ? micro_arena_malloc(ma, size)
+        : micro_arena_aligned_alloc(ma, 32, size);
+    }
+    assert(live[slot] != NULL);
+    assert(micro_arena_owns(ma, live[slot]));
+    assert(micro_arena_usable_size(ma, live[slot]) >= size);
+    memset(live[slot], (int)seed, size);
+  }
+  for (size_t i = 0; i < TEST_GROWTH_LIVE; ++i)
+    micro_arena_free(ma, live[i]);
+  return NULL;
+}
+
+void test_growth_threads(void)
+{
+  static char mem[1024];
+  static MicroArenaSize chunks[4 * 64];
+  MicroArena *ma = &test_growth_arena;
+  assert(micro_arena_init_chunks(ma, mem, sizeof(mem), chunks, 64));
+  micro_arena_set_growth(ma, 1024);
+
+  pthread_t threads[TEST_GROWTH_THREADS];
+  for (size_t i = 0; i < TEST_GROWTH_THREADS; ++i)
+    assert(pthread_create(&threads[i], NULL, test_growth_thread,
+                          (void*)(i + 1)) == 0);
+  for (size_t i = 0; i < TEST_GROWTH_THREADS; ++i)
+    pthread_join(threads[i], NULL);
+
+  assert(ma->next != NULL);
+  micro_arena_destroy(ma);
+}
+
+void test_trace(void)
+{
+  const char *path = "test_trace.bin";
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  assert(micro_arena_trace_start(path));
+  assert(!micro_arena_trace_start(path));
+  char* a = micro_arena_malloc(ma, 10);
+  char* b = micro_arena_aligned_alloc(ma, 64, 100);
+  char* c = micro_arena_realloc(ma, a, 50);
+  micro_arena_free(ma, b);
+  micro_arena_free(ma, c);
+  micro_arena_trace_stop();
+  micro_arena_free(ma, NULL);
+
+  // Only the outermost calls, not their internal malloc and free
+  char magic[8];
+  MicroArenaTraceRecord records[5];
+  FILE *file = fopen(path, "rb");
+  assert(file != NULL);
+  assert(fread(magic, 1, 8, file) == 8);
+  assert(memcmp(magic, MICRO_ARENA_TRACE_MAGIC, 8) == 0);
+  assert(fread(records, sizeof(records[0]), 5, file) == 5);
+  assert(fread(magic, 1, 1, file) == 0);
+  fclose(file);
+  remove(path);
+
+  assert(records[0].op == MICRO_ARENA_TRACE_MALLOC);
+  assert(records[0].result == (uintptr_t)a && records[0].size == 10);
+  assert(records[1].op == MICRO_ARENA_TRACE_ALIGNED_ALLOC);
+  assert(records[1].result == (uintptr_t)b && records[1].alignment == 64);
+  assert(records[2].op == MICRO_ARENA_TRACE_REALLOC);
+  assert(records[2].ptr == (uintptr_t)a && records[2].result == (uintptr_t)c);
+  assert(records[3].op == MICRO_ARENA_TRACE_FREE);
+  assert(records[3].ptr == (uintptr_t)b);
+  assert(records[4].ptr == (uintptr_t)c && records[4].thread == 1);
+  assert(records[0].time <= records[4].time);
+}
 
 int main(void)
 {
-  MicroArena ma;
-  micro_arena_init(&ma);
-  micro_arena_debug_print(&ma);
-  assert(ma.free_chunks.len == 1);
-  assert(ma.used_chunks.len == 0);
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+  micro_arena_debug_print(ma);
+  assert(ma->free_chunks.len == 1);
+  assert(ma->used_chunks.len == 0);
 
   int array_len = 10;
-  int* mem1 = micro_arena_malloc(&ma, sizeof(int) * array_len);
+  int* mem1 = micro_arena_malloc(ma, sizeof(int) * array_len);
   assert(mem1 != NULL);
-  assert(ma.free_chunks.len == 1);
-  assert(ma.used_chunks.len == 1);
+  assert(ma->free_chunks.len == 1);
+  assert(ma->used_chunks.len == 1);
   
-  char* mem2 = micro_arena_malloc(&ma, sizeof(char) * array_len);
+  char* mem2 = micro_arena_malloc(ma, sizeof(char) * array_len);
   assert(mem2 != NULL);
-  assert(ma.free_chunks.len == 1);
-  assert(ma.used_chunks.len == 2);
+  assert(ma->free_chunks.len == 1);
+  assert(ma->used_chunks.len == 2);
   
-  void* mem3 = micro_arena_malloc(&ma, 69);
+  void* mem3 = micro_arena_malloc(ma, 69);
   assert(mem3 != NULL);
-  assert(ma.free_chunks.len == 1);
-  assert(ma.used_chunks.len == 3);
+  assert(ma->free_chunks.len == 1);
+  assert(ma->used_chunks.len == 3);
   
-  micro_arena_debug_print(&ma);
+  micro_arena_debug_print(ma);
   
-  micro_arena_free(&ma, mem1);
-  assert(ma.free_chunks.len == 2);
-  assert(ma.used_chunks.len == 2);
+  micro_arena_free(ma, mem1);
+  assert(ma->free_chunks.len == 2);
+  assert(ma->used_chunks.len == 2);
 
-  micro_arena_free(&ma, mem3);
-  assert(ma.free_chunks.len == 2);
-  assert(ma.used_chunks.len == 1);
+  micro_arena_free(ma, mem3);
+  assert(ma->free_chunks.len == 2);
+  assert(ma->used_chunks.len == 1);
   
 
-  micro_arena_free(&ma, mem2);
-  assert(ma.free_chunks.len == 1);
-  assert(ma.used_chunks.len == 0);
+  micro_arena_free(ma, mem2);
+  assert(ma->free_chunks.len == 1);
+  assert(ma->used_chunks.len == 0);
   
-  micro_arena_debug_print(&ma);
+  micro_arena_debug_print(ma);
+
+  test_stats();
+  test_policies();
+  test_find_fit();
+  test_rounding();
+  test_pool();
+  test_buddy();
+  test_bitmap();
+  test_stack();
+  test_ring();
+  test_frame();
+  test_cache();
+  test_child();
+  test_compact();
+  test_reset();
+  test_cleanup();
+  test_aligned_alloc();
+  test_define();
+  test_size_classes();
+  test_usable_size();
+  test_free_sized();
+  test_growth_threads();
+  test_trace();
   
   return 0;
 }
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Tests of an arena built with MICRO_ARENA_BUDDY
+
+#define MICRO_ARENA_MULTITHREADED
+#define MICRO_ARENA_BUDDY
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <assert.h>
+#include <string.h>
+
+void test_buddy_aligned_alloc(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+
+  // Any alignment up to the block size, whatever the base of mem
+  size_t alignments[] = { 16, 32, 64, 256, 1024 };
+  for (size_t i = 0; i < sizeof(alignments) / sizeof(alignments[0]); ++i)
+  {
+    char* ptr = micro_arena_aligned_alloc(ma, alignments[i], 10);
+    assert(ptr != NULL);
+    assert((uintptr_t)ptr % alignments[i] == 0);
+    ptr[9] = 1;
+    micro_arena_free(ma, ptr);
+  }
+
+  // Everything merged back: the first allocation is the same again
+  char* a = micro_arena_aligned_alloc(ma, 64, 10);
+  char* b = micro_arena_aligned_alloc(ma, 64, 100);
+  assert(a && b && (uintptr_t)b % 128 == 0);
+  micro_arena_free(ma, a);
+  micro_arena_free(ma, b);
+  assert(micro_arena_aligned_alloc(ma, 64, 10) == a);
+  micro_arena_destroy(ma);
+}
+
+void test_buddy_growth(void)
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+  micro_arena_set_growth(ma, 4096);
+
+  // Segments fit the power of two block and the tags, not just size
+  char* a = micro_arena_malloc(ma, 3000);
+  char* b = micro_arena_malloc(ma, 3000);
+  char* c = micro_arena_malloc(ma, 10000);
+  assert(a && b && c);
+  assert(micro_arena_usable_size(ma, a) == 4096);
+  assert(micro_arena_usable_size(ma, c) == 16384);
+  a[2999] = b[2999] = c[9999] = 1;
+  micro_arena_free(ma, a);
+  micro_arena_free(ma, b);
+  micro_arena_free(ma, c);
+  micro_arena_destroy(ma);
+}
+
+// An arena with no memory of its own goes straight to its segments
+void test_buddy_empty(void)
+{
+  static MicroArenaSize chunks[4 * 4];
+  MicroArena ma;
+  // Stale memory, as on the stack
+  memset(&ma, 0xA5, sizeof(ma));
+  assert(micro_arena_init_chunks(&ma, NULL, 0, chunks, 4));
+  assert(micro_arena_malloc(&ma, 10) == NULL);
+  micro_arena_set_growth(&ma, 4096);
+
+  char* a = micro_arena_malloc(&ma, 100);
+  assert(a != NULL && ma.next != NULL);
+  micro_arena_free(&ma, a);
+  micro_arena_reset(&ma);
+  a = micro_arena_malloc(&ma, 100);
+  assert(a != NULL);
+  micro_arena_destroy(&ma);
+}
+
+int main(void)
+{
+  test_buddy_aligned_alloc();
+  test_buddy_growth();
+  test_buddy_empty();
+  return 0;
+}
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+#define MICRO_ARENA_MULTITHREADED
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+// Lazy coroutine returning an int
+struct task
+{
+  struct promise_type : micro_arena::coroutine_promise
+  {
+    int value = 0;
+
+    task get_return_object()
+    {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_value(int v) noexcept { value = v; }
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task &operator=(task &&) = delete;
+  ~task()
+  {
+    if (handle)
+      handle.destroy();
+  }
+
+  int get()
+  {
+    handle.resume();
+    return handle.promise().value;
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+task add(int a, int b)
+{
+  co_return a + b;
+}
+
+// Keeps a frame bigger than the biggest size class
+task sum(int n)
+{
+  volatile char bytes[512];
+  for (int i = 0; i < n; ++i)
+    bytes[i] = 1;
+  int total = 0;
+  for (int i = 0; i < n; ++i)
+    total += bytes[i];
+  co_return total;
+}
+
+void test_thread_arena()
+{
+  micro_arena::arena a;
+  {
+    task t = add(1, 2);
+    assert(!micro_arena_owns(a.get(), t.handle.address()));
+    assert(t.get() == 3);
+  }
+
+  micro_arena::coroutine_scope scope(a);
+  assert(micro_arena::coroutine_arena() == a.get());
+  {
+    task t = add(2, 3);
+    assert(micro_arena_owns(a.get(), t.handle.address()));
+    assert(t.get() == 5);
+  }
+  assert(a.get()->used_chunks.len == 0);
+
+  {
+    micro_arena::coroutine_scope inner(nullptr);
+    task t = add(3, 4);
+    assert(!micro_arena_owns(a.get(), t.handle.address()));
+  }
+  assert(micro_arena::coroutine_arena() == a.get());
+}
+
+void test_size_classes()
+{
+  micro_arena::arena a;
+  MicroArenaSizeClasses classes;
+  assert(micro_arena_size_classes_init(&classes, a.get(), 8));
+
+  void *frame;
+  {
+    micro_arena::coroutine_scope scope(a);
+    task t = add(1, 1);
+    frame = t.handle.address();
+    assert(micro_arena_owns(a.get(), frame));
+    assert(t.get() == 2);
+  }
+  {
+    // The slot of the frame is reused
+    micro_arena::coroutine_scope scope(a);
+    task t = add(2, 2);
+    assert(t.handle.address() == frame);
+    assert(t.get() == 4);
+  }
+
+  // Frames outlive the scope
+  task *t;
+  {
+    micro_arena::coroutine_scope scope(a);
+    t = new task(add(3, 3));
+  }
+  assert(t->handle.address() == frame);
+  assert(t->get() == 6);
+  delete t;
+
+  // Frames over the biggest class come from the arena itself
+  std::size_t used = a.get()->used_chunks.len;
+  {
+    micro_arena::coroutine_scope scope(a);
+    task s = sum(400);
+    assert(micro_arena_owns(a.get(), s.handle.address()));
+    assert(a.get()->used_chunks.len == used + 1);
+    assert(s.get() == 400);
+  }
+  assert(a.get()->used_chunks.len == used);
+  micro_arena_size_classes_destroy(&classes);
+
+  // Frames that do not fit go to the heap
+  micro_arena::basic_arena<64, 4> tiny;
+  micro_arena::coroutine_scope scope(tiny.get());
+  task big = add(4, 4);
+  assert(!micro_arena_owns(tiny.get(), big.handle.address()));
+  assert(big.get() == 8);
+}
+
+int main()
+{
+  test_thread_arena();
+  test_size_classes();
+  return 0;
+}
@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+#define MICRO_ARENA_MULTITHREADED
+#define MICRO_ARENA_IMPLEMENTATION
+#include "micro-arena.h"
+
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+void test_memory_resource()
+{
+  MicroArenaInline inl;
+  MicroArena *ma = &inl.arena;
+  micro_arena_init(&inl);
+  micro_arena::memory_resource resource(ma);
+  assert(resource.arena() == ma);
+
+  {
+    std::pmr::vector<int> v(&resource);
+    for (int i = 0; i < 100; ++i)
+      v.push_back(i);
+    assert(micro_arena_owns(ma, v.data()));
+    assert(v[99] == 99);
+
+    std::pmr::unordered_map<int, std::pmr::string> m(&resource);
+    for (int i = 0; i < 20; ++i)
+      m.emplace(i, "value");
+    assert(m.size() == 20 && m.at(7) == "value");
+  }
+  assert(ma->used_chunks.len == 0);
+
+  // Alignment is honoured
+  struct alignas(64) Line { char bytes[64]; };
+  std::pmr::polymorphic_allocator<Line> lines(&resource);
+  Line *line = lines.allocate(2);
+  assert(reinterpret_cast<std::uintptr_t>(line) % 64 == 0);
+  lines.deallocate(line, 2);
+  assert(ma->used_chunks.len == 0);
+
+  // A full arena throws
+  bool thrown = false;
+  try
+  {
+    void *ptr = resource.allocate(MICRO_ARENA_STACK_MEM_SIZE + 1);
+    (void)ptr;
+  }
+  catch (const std::bad_alloc &)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  MicroArenaInline other_inl;
+  MicroArena *other = &other_inl.arena;
+  micro_arena_init(&other_inl);
+  micro_arena::memory_resource same(ma), different(other);
+  assert(resource == same);
+  assert(resource != different);
+  assert(resource != *std::pmr::new_delete_resource());
+}
+
+void test_allocator()
+{
+  static_assert(!std::is_copy_constructible<micro_arena::arena>::value, "");
+  static_assert(std::is_nothrow_move_constructible<micro_arena::arena>::value,
+                "");
+
+  micro_arena::arena a;
+  micro_arena::allocator<int> alloc(a);
+  assert(alloc.arena() == a.get());
+
+  std::vector<int, micro_arena::allocator<int>> v(alloc);
+  for (int i = 0; i < 100; ++i)
+    v.push_back(i);
+  assert(micro_arena_owns(a.get(), v.data()));
+
+  // Node based containers rebind the allocator
+  using Map = std::map<int, int, std::less<int>,
+                       micro_arena::allocator<std::pair<const int, int>>>;
+  Map m(alloc);
+  for (int i = 0; i < 20; ++i)
+    m[i] = i * i;
+  assert(m.at(4) == 16);
+  assert(micro_arena::allocator<char>(alloc) == alloc);
+
+  // Moving the arena keeps the allocations in place
+  MicroArena *ma = a.get();
+  micro_arena::arena b(std::move(a));
+  assert(a.get() == nullptr && b.get() == ma);
+  assert(v[99] == 99 && m.at(19) == 361);
+
+  // The allocator moves with the container
+  micro_arena::arena other;
+  std::vector<int, micro_arena::allocator<int>> w(other);
+  w = std::move(v);
+  assert(w.get_allocator().arena() == ma);
+
+  w.clear();
+  w.shrink_to_fit();
+  m.clear();
+  assert(ma->used_chunks.len == 0);
+
+  // Growable arenas take more than MICRO_ARENA_STACK_MEM_SIZE
+  micro_arena::arena growing(1 << 16);
+  std::vector<char, micro_arena::allocator<char>> big(
+    2 * MICRO_ARENA_STACK_MEM_SIZE, 'x', growing);
+  assert(micro_arena_owns(growing.get(), big.data()));
+}
+
+void test_basic_arena()
+{
+  micro_arena::basic_arena<512, 8> small;
+  static micro_arena::basic_arena<(1 << 20), 4096, MICRO_ARENA_BEST_FIT> big;
+  static_assert(decltype(small)::capacity == 512, "");
+  // A MicroArena and its own storage, not the one of MicroArenaInline
+  static_assert(sizeof(small) < sizeof(MicroArena) + 512
+                + 32 * sizeof(MicroArenaSize) + 32, "");
+  assert(small.get()->capacity == 512 && small.get()->free_chunks.cap == 8);
+  assert(big.get()->capacity == (1 << 20));
+  assert(big.get()->policy == MICRO_ARENA_BEST_FIT);
+
+  void *p = small.allocate(100, 64);
+  assert(reinterpret_cast<std::uintptr_t>(p) % 64 == 0);
+  small.deallocate(p);
+  assert(small.get()->used_chunks.len == 0);
+  void *q = small.allocate(40);
+  void *r = small.allocate(24);
+  small.deallocate(q, 40);
+  small.deallocate(r, 24);
+  assert(small.get()->used_chunks.len == 0);
+
+  std::vector<int, micro_arena::allocator<int>> v(big);
+  v.resize(100000);
+  assert(micro_arena_owns(big.get(), v.data()));
+
+  bool thrown = false;
+  try
+  {
+    small.allocate(513);
+  }
+  catch (const std::bad_alloc &)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+  small.reset();
+}
+
+struct Counted
+{
+  static int live;
+  int value;
+  explicit Counted(int v) : value(v) { ++live; }
+  ~Counted() { --live; }
+};
+int Counted::live = 0;
+
+struct alignas(64) Wide
+{
+  char bytes[64];
+};
+
+struct Throwing
+{
+  Throwing() { throw 1; }
+};
+
+void test_make()
+{
+  static_assert(micro_arena::size_class(sizeof(Counted)) == 0);
+  static_assert(micro_arena::size_class(1 << 20) == MICRO_ARENA_SIZE_CLASSES);
+
+  micro_arena::arena a;
+  MicroArenaSizeClasses classes;
+  assert(micro_arena_size_classes_init(&classes, a.get(), 16));
+
+  Counted *c = micro_arena::make<Counted>(a, 7);
+  assert(c->value == 7 && Counted::live == 1);
+  assert(classes.pools[0].slabs != nullptr);
+  micro_arena::destroy(a, c);
+  assert(Counted::live == 0);
+  assert(micro_arena::make<Counted>(a, 8) == c);
+  micro_arena::destroy(a, c);
+
+  // Over-aligned types skip the pools
+  Wide *w = micro_arena::make<Wide>(a);
+  assert(reinterpret_cast<std::uintptr_t>(w) % 64 == 0);
+  micro_arena::destroy(a, w);
+
+  bool thrown = false;
+  try
+  {
+    micro_arena::make<Throwing>(a);
+  }
+  catch (int)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+  assert(micro_arena::make<Counted>(a, 9) == c);
+  micro_arena::destroy(a, c);
+
+  micro_arena_size_classes_destroy(&classes);
+
+  micro_arena::basic_arena<512, 8> small;
+  int *i = micro_arena::make<int>(small, 3);
+  assert(*i == 3 && small.get()->used_chunks.len == 1);
+  micro_arena::destroy(small, i);
+  assert(small.get()->used_chunks.len == 0);
+}
+
+void test_inline_arena()
+{
+  // Counts what reaches the upstream resource
+  struct counting_resource : std::pmr::memory_resource
+  {
+    int live = 0;
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+      ++live;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *ptr, std::size_t bytes,
+                       std::size_t alignment) override
+    {
+      --live;
+      std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other)
+      const noexcept override
+    {
+      return this == &other;
+    }
+  } upstream;
+
+  micro_arena::inline_arena<256> small(&upstream);
+  assert(small.upstream() == &upstream);
+  {
+    std::pmr::vector<int> v(&small);
+    v.reserve(16);
+    for (int i = 0; i < 16; ++i)
+      v.push_back(i);
+    assert(small.owns(v.data()) && upstream.live == 0);
+
+    // Too big for the inline memory
+    v.reserve(1000);
+    assert(!small.owns(v.data()) && upstream.live == 1);
+    assert(v[15] == 15);
+
+    std::pmr::string s("short", &small);
+    assert(small.get()->used_chunks.len <= 1);
+  }
+  assert(upstream.live == 0 && small.get()->used_chunks.len == 0);
+
+  micro_arena::inline_arena<128> other;
+  assert(other.upstream() == std::pmr::get_default_resource());
+  assert(!other.is_equal(small) && small.is_equal(small));
+}
+
+void test_arena_owned()
+{
+  {
+    micro_arena::arena_owned a(1 << 16);
+    for (int i = 0; i < 1000; ++i)
+      assert(a.create<Counted>(i)->value == i);
+    assert(Counted::live == 1000);
+
+    a.reset();
+    assert(Counted::live == 0 && a.get()->cleanups == nullptr);
+
+    // Trivially destructible objects are not registered
+    int *i = a.create<int>(5);
+    assert(*i == 5 && a.get()->cleanups == nullptr);
+    a.create<Counted>(1);
+    assert(a.get()->cleanups != nullptr);
+
+    micro_arena::arena_owned b(std::move(a));
+    assert(a.get() == nullptr && Counted::live == 1);
+  }
+  assert(Counted::live == 0);
+
+  // The object is destroyed if its cleanup does not fit
+  micro_arena::basic_arena<32, 4> tiny;
+  bool thrown = false;
+  try
+  {
+    micro_arena::create<Counted>(tiny.get(), 1);
+  }
+  catch (const std::bad_alloc &)
+  {
+    thrown = true;
+  }
+  assert(thrown && Counted::live == 0);
+  assert(tiny.get()->used_chunks.len == 0);
+}
+
+int main()
+{
+  test_memory_resource();
+  test_allocator();
+  test_basic_arena();
+  test_make();
+  test_inline_arena();
+  test_arena_owned();
+  return 0;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Threads allocating, growing and freeing with the C library, also
+// across threads, to run under the preload shim:
+//
+//   LD_PRELOAD=./libmicroarena.so ./test_threads
+
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_THREADS 4
+#define TEST_LIVE    64
+#define TEST_ROUNDS  2000
+
+// Blocks handed from one thread to another
+static void *test_shared[TEST_LIVE];
+static pthread_mutex_t test_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Fill ptr with a pattern of seed, checked before it is freed
+static void test_fill(unsigned char *ptr, size_t size, unsigned char seed)
+{
+  memset(ptr, seed, size);
+  return;
+}
+
+static void test_check(const unsigned char *ptr, size_t size,
+                       unsigned char seed)
+{
+  for (size_t i = 0; i < size; ++i)
+    assert(ptr[i] == seed);
+  return;
+}
+
+static void *test_thread(void *arg)
+{
+  size_t id = (size_t)arg;
+  unsigned char *live[TEST_LIVE] = { NULL };
+  size_t sizes[TEST_LIVE] = { 0 };
+  for (size_t i = 0; i < TEST_ROUNDS; ++i)
+  {
+    size_t slot = (id * 17 + i * 7) % TEST_LIVE;
+    // Up to 64 KiB, so that the arena grows past its first segment
+    size_t size = 1 + (id * 131 + i * 977) % 65536;
+    unsigned char seed = (unsigned char)(id + slot);
+
+    if (live[slot] && i % 3 == 0)
+    {
+      test_check(live[slot], sizes[slot] < size ? sizes[slot] : size, seed);
+      unsigned char *mem = realloc(live[slot], size);
+      assert(mem != NULL);
+      test_check(mem, sizes[slot] < size ? sizes[slot] : size, seed);
+      live[slot] = mem;
+    }
+    else
+    {
+      if (live[slot])
+        test_check(live[slot], sizes[slot], seed);
+      free(live[slot]);
+      live[slot] = NULL;
+      if (i % 5 == 0)
+      {
+        int error = posix_memalign((void**)&live[slot], 64, size);
+        assert(error == 0);
+        (void)error;
+        assert((uintptr_t)live[slot] % 64 == 0);
+      }
+      else
+        live[slot] = malloc(size);
+      assert(live[slot] != NULL);
+    }
+    sizes[slot] = size;
+    test_fill(live[slot], size, seed);
+
+    // Free what another thread allocated
+    pthread_mutex_lock(&test_shared_mutex);
+    free(test_shared[slot]);
+    test_shared[slot] = calloc(1, 32);
+    assert(test_shared[slot] != NULL);
+    pthread_mutex_unlock(&test_shared_mutex);
+  }
+  for (size_t i = 0; i < TEST_LIVE; ++i)
+    free(live[i]);
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t threads[TEST_THREADS];
+  for (size_t i = 0; i < TEST_THREADS; ++i)
+    assert(pthread_create(&threads[i], NULL, test_thread,
+                          (void*)(i + 1)) == 0);
+  for (size_t i = 0; i < TEST_THREADS; ++i)
+    pthread_join(threads[i], NULL);
+  for (size_t i = 0; i < TEST_LIVE; ++i)
+    free(test_shared[i]);
+
+  // Memory the arena does not own is left alone
+  static char foreign[16] = "foreign";
+  char *volatile ptr = foreign;
+  errno = 0;
+  assert(realloc(ptr, 64) == NULL && errno == EINVAL);
+  assert(strcmp(foreign, "foreign") == 0);
+  free(ptr);
+  return 0;
+}